@@ -0,0 +1,165 @@
+#pragma once
+
+// Summed-area table of a remap source for the "area" engine. Any axis
+// aligned box of the source can be averaged with a constant number of
+// lookups, however many source pixels it covers.
+//
+// Source pixel i covers [i-0.5, i+0.5]. The equirectangular source is
+// periodic in x with period width-1 (column width-1 is the same
+// longitude as column 0), so the table covers columns 0..width-2 and
+// boxes may extend past either edge or span the whole width.
+
+#include "image.h"
+
+#include <vector>
+#include <cmath>
+
+struct SummedAreaTable
+{
+    size_t width;       // of the source
+    size_t height;
+    size_t period;      // columns before the source repeats (width-1)
+    
+    // sums[4*((period+1)*Y + X) + c] = sum of channel c over all pixels
+    // with x < X and y < Y
+    std::vector<double> sums;
+    
+    SummedAreaTable() : width(0), height(0), period(0) {}
+    
+    template<typename Src>
+    void build(const Src& from);
+    
+    // integral of the periodic source over [-0.5, u] x [-0.5, v]
+    void integral(double u, double v, double* out) const
+    {
+        const size_t stride = period + 1;
+        
+        double k = floor((u + 0.5) / period);
+        double X = u + 0.5 - k*period;
+        double Y = v + 0.5;
+        
+        if(Y < 0)
+            Y = 0;
+        if(Y > height)
+            Y = height;
+        
+        size_t x0 = (size_t)X;
+        size_t y0 = (size_t)Y;
+        
+        if(x0 >= period)
+            x0 = period - 1;
+        if(y0 >= height)
+            y0 = height - 1;
+        
+        double fx = X - x0;
+        double fy = Y - y0;
+        
+        const double* r0 = &sums[4*stride*y0];
+        const double* r1 = &sums[4*stride*(y0+1)];
+        
+        for(int c = 0; c < 4; c++)
+        {
+            double a = k*r0[4*period + c] + 
+                (1-fx)*r0[4*x0 + c] + fx*r0[4*(x0+1) + c];
+            double b = k*r1[4*period + c] + 
+                (1-fx)*r1[4*x0 + c] + fx*r1[4*(x0+1) + c];
+            
+            out[c] = (1-fy)*a + fy*b;
+        }
+    }
+    
+    // average over the box x0..x1, y0..y1 (x0 <= x1, y0 <= y1); boxes
+    // smaller than a pixel are grown to one pixel, which makes the
+    // result a bilinear interpolation
+    RGBAF box(double x0, double y0, double x1, double y1) const
+    {
+        if(x1 - x0 < 1.0)
+        {
+            double cx = (x0 + x1) / 2;
+            x0 = cx - 0.5;
+            x1 = cx + 0.5;
+        }
+        
+        if(y1 - y0 < 1.0)
+        {
+            double cy = (y0 + y1) / 2;
+            y0 = cy - 0.5;
+            y1 = cy + 0.5;
+        }
+        
+        // rows outside the image would only add zero area; a box pushed
+        // past the top or bottom edge keeps at least one row
+        if(y0 < -0.5)
+        {
+            y0 = -0.5;
+            if(y1 < 0.5)
+                y1 = 0.5;
+        }
+        if(y1 > height - 0.5)
+        {
+            y1 = height - 0.5;
+            if(y0 > height - 1.5)
+                y0 = height - 1.5;
+        }
+        
+        double a[4], b[4], c[4], d[4];
+        integral(x0, y0, a);
+        integral(x1, y0, b);
+        integral(x0, y1, c);
+        integral(x1, y1, d);
+        
+        double scale = 1.0 / ((x1 - x0) * (y1 - y0));
+        
+        return RGBAF(
+            (d[0] - c[0] - b[0] + a[0]) * scale,
+            (d[1] - c[1] - b[1] + a[1]) * scale,
+            (d[2] - c[2] - b[2] + a[2]) * scale,
+            (d[3] - c[3] - b[3] + a[3]) * scale);
+    }
+};
+
+template<typename Src>
+void SummedAreaTable::build(const Src& from)
+{
+    width = from.width;
+    height = from.height;
+    period = width > 1 ? width - 1 : 1;
+    
+    const size_t stride = period + 1;
+    sums.assign(4 * stride * (height+1), 0.0);
+    
+    // running sums along each row, then down each column; the column
+    // pass works on blocks of columns so every row access is contiguous
+    #pragma omp parallel for
+    for(size_t y = 0; y < height; y++)
+    {
+        double* row = &sums[4*stride*(y+1)];
+        
+        for(size_t x = 0; x < period; x++)
+        {
+            const RGBAF& p = source_pixel(from, x, y);
+            
+            row[4*(x+1) + 0] = row[4*x + 0] + p.r;
+            row[4*(x+1) + 1] = row[4*x + 1] + p.g;
+            row[4*(x+1) + 2] = row[4*x + 2] + p.b;
+            row[4*(x+1) + 3] = row[4*x + 3] + p.a;
+        }
+    }
+    
+    const size_t BLOCK = 64;
+    
+    #pragma omp parallel for
+    for(size_t x0 = 0; x0 < stride; x0 += BLOCK)
+    {
+        size_t x1 = x0 + BLOCK < stride ? x0 + BLOCK : stride;
+        
+        for(size_t y = 1; y <= height; y++)
+        {
+            double* row = &sums[4*stride*y];
+            const double* above = &sums[4*stride*(y-1)];
+            
+            for(size_t i = 4*x0; i < 4*x1; i++)
+                row[i] += above[i];
+        }
+    }
+}
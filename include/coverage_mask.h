@@ -0,0 +1,77 @@
+#pragma once
+
+// Coarse map of a remap source's alpha, in blocks of BLOCK x BLOCK
+// pixels. Partial panoramas often leave the nadir or zenith empty; an
+// output tile whose samples can only reach empty blocks is filled
+// directly, and one that only reaches opaque blocks is rendered without
+// its alpha channel, so only tiles over the edge of the coverage get the
+// full four channel filter.
+//
+// The mask can be built while the source is still being decoded (see
+// row_progress.h); blocks below rows_built are not known yet and count
+// as mixed.
+
+#include "image.h"
+#include "custom_math.h"
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+enum Coverage
+{
+    COVERAGE_EMPTY,     // every pixel is 0, 0, 0, 0
+    COVERAGE_OPAQUE,    // every alpha is 1
+    COVERAGE_MIXED
+};
+
+struct CoverageMask
+{
+    static const size_t BLOCK = 16;
+    
+    size_t width;       // of the source
+    size_t height;
+    
+    // the image the mask was made from; the engines only use the mask
+    // when they sample that very image, not others of the same size
+    const void* image;
+    size_t blocks_x;
+    size_t blocks_y;
+    
+    // blocks[blocks_x*by + bx] holds a Coverage
+    std::vector<unsigned char> blocks;
+    
+    // source rows whose blocks are final (a multiple of BLOCK, or height)
+    std::atomic<size_t> rows_built;
+    
+    CoverageMask() : width(0), height(0), image(0), blocks_x(0),
+        blocks_y(0), rows_built(0) {}
+    
+    // sizes the mask for source, with nothing built yet
+    void resize(const Image<RGBAF>& source);
+    
+    // builds the blocks that lie within rows 0 .. rows-1 of from, which
+    // must be the image the mask was sized for; not thread safe against
+    // itself, but region() may run meanwhile
+    void build_rows(const Image<RGBAF>& from, size_t rows);
+    
+    void build(const Image<RGBAF>& from)
+    {
+        resize(from);
+        build_rows(from, from.height);
+    }
+    
+    // coverage of source columns x0..x1 and rows y0..y1 (inclusive).
+    // Columns are periodic with period width-1 and may lie outside the
+    // image; rows must be inside it.
+    Coverage region(long x0, size_t y0, long x1, size_t y1) const;
+};
+
+// coverage of every source pixel that the remap samples of output tile
+// x0..x1-1, y0..y1-1 (rows of the whole output) can read, rotated by rot
+// into an output_width x output_height panorama. Tiles whose samples
+// reach over a pole of the output or around one of the source are
+// reported as mixed.
+Coverage tile_coverage(const CoverageMask& mask, Mat3 rot,
+    size_t output_width, size_t output_height, size_t x0, size_t y0,
+    size_t x1, size_t y1);
@@ -56,7 +56,20 @@ struct LL2Vec3_Table
     int subpixels;
     
     LL2Vec3_Table(int w, int h, int s);
-    Vec3 lookup(int x, int sub_x, int y, int sub_y);
+    
+    // inline so the remap kernels can keep it in their inner loops
+    Vec3 lookup(int x, int sub_x, int y, int sub_y) const
+    {
+        int long_ = x * subpixels + sub_x;
+        int lat   = y * subpixels + sub_y;
+        
+        Vec3 result;
+        result.x = cos_long[long_] * cos_lat[lat];
+        result.y = sin_long[long_] * cos_lat[lat];
+        result.z = sin_lat[lat];
+        
+        return result;
+    }
 };
 
 
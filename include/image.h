@@ -1,5 +1,7 @@
 #pragma once
 
+#include "image_memory.h"
+
 #include <vector>
 #include <string>
 
@@ -75,14 +77,14 @@ RGBAF bilinear(double x, double y, RGBAF* values);
 template<typename T>
 struct Image
 {
-    std::vector<T> values;
+    std::vector<T, ImageAllocator<T> > values;
     size_t width;
     size_t height;
     
     Image() : width(0), height(0) {}
-    Image(size_t w, size_t h) : width(w), height(h)
+    Image(size_t w, size_t h) : width(0), height(0)
     {
-        values.resize(w*h);
+        resize(w, h);
     }
     
     void clear(const T& value)
@@ -97,11 +99,28 @@ struct Image
         clear(T());
     }
     
+    // new pixels are constructed a row at a time with the same split of
+    // rows over the threads as the static remap schedule, so their pages
+    // are first touched by the threads that write them during a remap
     void resize(size_t W, size_t H)
     {
+        size_t old_size = values.size();
+        
         width = W;
         height = H;
         values.resize(W*H);
+        
+        T* p = values.data();
+        const size_t count = W*H;
+        
+        #pragma omp parallel for if(count - old_size >= 65536)
+        for(long y = 0; y < (long)H; y++)
+        {
+            size_t begin = W*y > old_size ? W*y : old_size;
+            
+            for(size_t i = begin; i < W*(y+1); i++)
+                ::new((void*)(p + i)) T();
+        }
     }
     
     void put(size_t x, size_t y, const T& value)
@@ -147,19 +166,92 @@ struct Image
 
 RGBAF bilinear_get(const Image<RGBAF>& src, double x, double y);
 
+// IEEE 754 half precision conversions (round to nearest even)
+float half_to_float(uint16_t h);
+uint16_t float_to_half(float f);
+
+// how the samples of an image file are stored
+enum SampleFormat
+{
+    SAMPLE_UINT,    // unsigned integers scaled to 0.0 - 1.0
+    SAMPLE_FLOAT    // IEEE floats (bps 16 = half, 32 = single), unscaled
+};
+
 struct ImageLoadResult
 {
     bool ok;
     
     uint32_t bps;
     uint32_t spp;
+    SampleFormat format;
+    
+    // > 1 when a JPEG was decoded at reduced size (1/2, 1/4 or 1/8)
+    uint32_t scale_denom;
     
-    ImageLoadResult() : ok(false), bps(8), spp(3) {}
+    // the loaded rows are rows first_row and up of an image that is
+    // full_height rows tall (see ImageLoadParams)
+    size_t first_row;
+    size_t full_height;
+    
+    ImageLoadResult() : ok(false), bps(8), spp(3), format(SAMPLE_UINT),
+        scale_denom(1), first_row(0), full_height(0) {}
 };
 
-ImageLoadResult load(Image<RGBAF>& into, const std::string& path);
-ImageLoadResult load_tiff(Image<RGBAF>& into, const std::string& path);
-ImageLoadResult load_jpeg(Image<RGBAF>& into, const std::string& path);
+// told about a load as it goes, so the rows can be used before load()
+// returns (see row_progress.h). Calls come from the loading thread(s).
+struct RowListener
+{
+    virtual ~RowListener() {}
+    
+    // into has its final size; info has the sample layout and row window
+    // of the image (info.ok is still false)
+    virtual void image_sized(const ImageLoadResult& info) = 0;
+    
+    // rows 0 .. rows-1 of into hold their final pixels
+    virtual void rows_ready(size_t rows) = 0;
+};
+
+struct ImageLoadParams
+{
+    // JPEGs may be decoded at reduced size in the DCT domain as long as
+    // the decoded width stays at or above this (0 = full size)
+    size_t min_width;
+    
+    // only the rows between these fractions of the image height (row
+    // fraction * (height-1)), plus a margin of ROW_MARGIN rows for the
+    // filters, are decoded and kept. TIFF strips and tiles outside them
+    // are never read, and JPEG and PNG decoding stops after the last.
+    double first_row_fraction;
+    double last_row_fraction;
+    
+    static const size_t ROW_MARGIN = 2;
+    
+    // reported to as rows are decoded (0 = none)
+    RowListener* listener;
+    
+    ImageLoadParams() : min_width(0), first_row_fraction(0.0), 
+        last_row_fraction(1.0), listener(0) {}
+    
+    // the rows of an image height rows tall that a load keeps
+    void row_window(size_t height, size_t& first, size_t& last) const;
+};
+
+ImageLoadResult load(Image<RGBAF>& into, const std::string& path,
+    const ImageLoadParams& params = ImageLoadParams());
+ImageLoadResult load_tiff(Image<RGBAF>& into, const std::string& path,
+    const ImageLoadParams& params = ImageLoadParams());
+ImageLoadResult load_jpeg(Image<RGBAF>& into, const std::string& path,
+    const ImageLoadParams& params = ImageLoadParams());
+ImageLoadResult load_png(Image<RGBAF>& into, const std::string& path,
+    const ImageLoadParams& params = ImageLoadParams());
+
+// the size load() would return for the whole image, from the file header
+bool read_image_size(const std::string& path, const ImageLoadParams& params,
+    size_t& width, size_t& height);
+
+// same, plus the sample layout load() would report (layout.ok is false)
+bool read_image_info(const std::string& path, const ImageLoadParams& params,
+    size_t& width, size_t& height, ImageLoadResult& layout);
 
 
 struct ImageSaveParams
@@ -167,21 +259,58 @@ struct ImageSaveParams
     // save_tiff needs this info:
     uint32_t bps;
     uint32_t spp;
+    SampleFormat format;
     
     // save_jpeg needs this info:
     int quality;
     
-    ImageSaveParams() : bps(8), spp(3), quality(90) {}
+    // save_png needs this info (zlib level 0-9):
+    int png_level;
+    
+    // written as the TIFF ImageDescription when not empty
+    std::string description;
+    
+    ImageSaveParams() : bps(8), spp(3), format(SAMPLE_UINT), quality(90),
+        png_level(6) {}
 };
 
 void save_jpeg(const Image<RGBAF>& from, const std::string& path,
     ImageSaveParams params);
+
+// save_jpeg that reports whether the file could be written
+bool write_jpeg(const Image<RGBAF>& from, const std::string& path,
+    ImageSaveParams params);
     
 void save_tiff(const Image<RGBAF>& from, const std::string& path, 
     ImageSaveParams params);
 
+void save_png(const Image<RGBAF>& from, const std::string& path, 
+    ImageSaveParams params);
+
+// incremental encoder: the image is written top to bottom a band of rows
+// at a time, so encoding can start before the whole image exists. The
+// file is finished when the writer is deleted.
+struct RowWriter
+{
+    virtual ~RowWriter() {}
+    
+    // appends every row of band; band.width must match the image width
+    virtual bool write_rows(const Image<RGBAF>& band) = 0;
+};
+
+// these return 0 (after printing why) if the file can't be written
+RowWriter* open_jpeg_writer(const std::string& path, size_t width,
+    size_t height, ImageSaveParams params);
+
+RowWriter* open_tiff_writer(const std::string& path, size_t width,
+    size_t height, ImageSaveParams params);
+
 
 void convert_image(Image<RGB8>& dst, const Image<RGBAF>& src);
 
+// resizes src to width x height by area averaging (meant for shrinking)
+void downscale(Image<RGBAF>& dst, const Image<RGBAF>& src, 
+    size_t width, size_t height);
+
 
 
@@ -0,0 +1,76 @@
+#pragma once
+
+// Pixel storage for Image and TiledImage. Buffers are 64-byte aligned
+// (one cache line, and whole RGBAF pixels per line) and, when enabled,
+// large ones are 2 MiB aligned and advised for transparent huge pages so
+// a big source needs a few hundred TLB entries instead of a few hundred
+// thousand. The allocator never initializes elements itself: the images
+// construct them in parallel, so each page is first touched, and on a
+// NUMA machine placed, by a thread that will later work on it.
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// applies to allocations made after the call (default off)
+void set_huge_pages(bool enable);
+bool huge_pages();
+
+// returns 0 on failure; free with image_free(p, bytes)
+void* image_alloc(size_t bytes);
+void image_free(void* p, size_t bytes);
+
+template<typename T>
+struct ImageAllocator
+{
+    typedef T value_type;
+    
+    template<typename U>
+    struct rebind
+    {
+        typedef ImageAllocator<U> other;
+    };
+    
+    ImageAllocator() {}
+    
+    template<typename U>
+    ImageAllocator(const ImageAllocator<U>&) {}
+    
+    T* allocate(size_t n)
+    {
+        void* p = image_alloc(n * sizeof(T));
+        
+        if(!p)
+            throw std::bad_alloc();
+        
+        return (T*)p;
+    }
+    
+    void deallocate(T* p, size_t n)
+    {
+        image_free(p, n * sizeof(T));
+    }
+    
+    // default construction (vector::resize) is left to the image, which
+    // does it from the threads that own each part of the buffer
+    template<typename U>
+    void construct(U*) {}
+    
+    template<typename U, typename... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new((void*)p) U(std::forward<Args>(args)...);
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const ImageAllocator<T>&, const ImageAllocator<U>&)
+{
+    return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const ImageAllocator<T>&, const ImageAllocator<U>&)
+{
+    return false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "custom_math.h"
+
+#include <string>
+
+// how a JPEG to JPEG yaw rotation may bypass the resampler
+enum LosslessMode
+{
+    LOSSLESS_OFF,       // always decode, remap and re-encode
+    LOSSLESS_EXACT,     // only for yaws that are a whole number of MCUs
+    LOSSLESS_SNAP       // round any pure yaw to the nearest MCU
+};
+
+enum LosslessResult
+{
+    LOSSLESS_WRITTEN,   // output written without touching pixels
+    LOSSLESS_SKIPPED,   // not applicable; use the normal path
+    LOSSLESS_FAILED
+};
+
+bool parse_lossless_mode(LosslessMode& out, const std::string& name);
+
+// true if rot only spins about the vertical (Z) axis; yaw gets the angle
+bool pure_yaw(Mat3 rot, double& yaw);
+
+// writes the JPEG at in_path to out_path turned by yaw radians, moving
+// the compressed DCT blocks of each row around instead of decoding them.
+// The yaw is measured like the resampler's (width-1 columns per turn)
+// and must move a whole number of MCU columns (8 or 16 pixels); in SNAP
+// mode it is rounded to one. The blocks wrap around every width columns.
+// Markers such as EXIF and XMP are copied. out_path may be in_path.
+// output_width of 0 means the input width; any other width is skipped.
+// applied_yaw gets the yaw actually written, in radians.
+LosslessResult jpeg_lossless_yaw(const std::string& in_path,
+    const std::string& out_path, double yaw, LosslessMode mode,
+    size_t output_width, double& applied_yaw);
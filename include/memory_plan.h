@@ -0,0 +1,75 @@
+#pragma once
+
+// Chooses how a single output render is run so that it stays within a
+// memory budget (--max-memory). The peak of each strategy is estimated
+// from the input header and the output size before anything is
+// allocated, and the fastest strategy that fits is used.
+
+#include "image.h"
+#include "custom_math.h"
+#include "remap.h"
+
+#include <string>
+
+// fastest first
+enum RenderStrategy
+{
+    RENDER_IN_CORE,     // the whole source as RGBAF (32 bytes per pixel)
+    RENDER_SAMPLES,     // the whole source in its file's samples
+    RENDER_BANDS        // the output in bands, each decoding only the
+                        // source rows it can sample
+};
+
+// what a render has to hold, known from the input header and the flags
+struct RenderJob
+{
+    size_t source_width;
+    size_t source_height;
+    ImageLoadResult layout;     // sample layout of the source
+    
+    size_t output_width;
+    size_t output_height;
+    
+    Mat3 rot;
+    RemapEngine engine;
+    
+    // the output format can be written a band of rows at a time; if not,
+    // the whole output is held along with up to output_bytes per pixel
+    // of encoded data
+    bool streamed;
+    size_t output_bytes;
+    
+    RenderJob() : source_width(0), source_height(0), output_width(0),
+        output_height(0), rot(ident()), engine(ENGINE_FULL3),
+        streamed(true), output_bytes(0) {}
+};
+
+struct MemoryPlan
+{
+    RenderStrategy strategy;
+    size_t bands;           // RENDER_BANDS: number of output bands
+    size_t peak;            // estimated peak in bytes
+    
+    MemoryPlan() : strategy(RENDER_IN_CORE), bands(1), peak(0) {}
+};
+
+// parses a byte count with an optional K, M, G or T suffix (powers of
+// 1024), such as "512M" or "1.5G"
+bool parse_memory_size(size_t& bytes, const std::string& text);
+
+// for messages, such as "1.5 GiB"
+std::string memory_size_text(size_t bytes);
+
+const char* strategy_name(RenderStrategy strategy);
+
+// false if the strategy can't render this job at all
+bool estimate_peak(size_t& peak, const RenderJob& job,
+    RenderStrategy strategy, size_t bands = 1);
+
+// the fastest plan estimated to fit in budget bytes. If none does,
+// returns false with plan set to the smallest estimate.
+bool plan_render(MemoryPlan& plan, const RenderJob& job, size_t budget);
+
+// output rows first .. end-1 make band k of an output split into bands
+void plan_band(size_t output_height, size_t bands, size_t k, size_t& first,
+    size_t& end);
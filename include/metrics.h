@@ -0,0 +1,40 @@
+#pragma once
+
+#include "image.h"
+
+// image quality statistics of one image against a reference; per channel
+// values are stored in the r, g and b fields (alpha is not compared)
+struct ImageMetrics
+{
+    // computed on the float values
+    RGBAF sad;          // sum of absolute differences
+    RGBAF mad;          // mean absolute difference
+    RGBAF ssd;          // sum of squared differences
+    RGBAF max_error;    // largest absolute difference
+    RGBAF psnr;         // peak signal to noise ratio in dB (peak = 1.0)
+    RGBAF ssim;         // mean structural similarity over 8x8 windows
+    
+    // same differences after quantizing both images to 8 bits
+    RGBAF sad8;
+    RGBAF mad8;
+    RGBAF ssd8;
+    
+    // averages over the three color channels
+    double mean_psnr;
+    double mean_ssim;
+    
+    ImageMetrics() : sad(0,0,0,0), mad(0,0,0,0), ssd(0,0,0,0), 
+        max_error(0,0,0,0), psnr(0,0,0,0), ssim(0,0,0,0), sad8(0,0,0,0),
+        mad8(0,0,0,0), ssd8(0,0,0,0), mean_psnr(0), mean_ssim(0) {}
+};
+
+// compares test against ref (which must be the same size) in a single
+// parallel pass. If heatmap is given it receives a per pixel error image
+// where black is exact and white is an error of heat_range or more.
+ImageMetrics compare_images(
+    const Image<RGBAF>& ref,
+    const Image<RGBAF>& test,
+    Image<RGBAF>* heatmap = 0,
+    double heat_range = 0.1);
+
+void print_metrics(const ImageMetrics& m);
@@ -0,0 +1,89 @@
+#pragma once
+
+/*
+ *  panorotate library API
+ *
+ *  Rotates an equirectangular panorama held in caller owned memory into
+ *  another caller owned buffer. Pixels are read and written in place in
+ *  their own format and layout; nothing is copied into intermediate
+ *  images. Calls don't share any state, so several rotations may run at
+ *  the same time from different threads.
+ *
+ *  Link with libpanorotate.a or libpanorotate.so (built by 'make lib').
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum pr_format
+{
+    PR_FORMAT_U8,       /* 0 - 255 maps to 0.0 - 1.0 */
+    PR_FORMAT_U16,      /* 0 - 65535 maps to 0.0 - 1.0 */
+    PR_FORMAT_F16,      /* IEEE half float, unscaled */
+    PR_FORMAT_F32       /* IEEE single float, unscaled */
+} pr_format;
+
+typedef enum pr_layout
+{
+    PR_LAYOUT_INTERLEAVED,  /* RGB(A) samples together in data[0] */
+    PR_LAYOUT_PLANAR        /* one plane per channel in data[0..3] */
+} pr_layout;
+
+typedef enum pr_engine
+{
+    PR_ENGINE_FULL3,    /* supersampled gaussian filter (default) */
+    PR_ENGINE_FAST,     /* one bilinear sample per pixel */
+    PR_ENGINE_AREA      /* footprint averaged from a summed-area table */
+} pr_engine;
+
+typedef enum pr_status
+{
+    PR_OK = 0,
+    PR_ERROR_ARGUMENT,      /* null pointer, zero size, row_stride shorter
+                               than a row or an option out of range */
+    PR_ERROR_FORMAT,        /* unknown format, layout or channel count */
+    PR_ERROR_OVERLAP,       /* source and destination share memory */
+    PR_ERROR_MEMORY         /* the engine's tables could not be allocated */
+} pr_status;
+
+typedef struct pr_image
+{
+    void* data[4];      /* interleaved: data[0] only; planar: per channel */
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;  /* 3 (RGB) or 4 (RGBA) */
+    pr_format format;
+    pr_layout layout;
+    size_t row_stride;  /* bytes between rows (of each plane); 0 = packed,
+                           otherwise at least the packed row */
+} pr_image;
+
+typedef struct pr_options
+{
+    pr_engine engine;
+    int samples;        /* full3 subsamples per axis, odd, 1 - 31
+                           (default 9) */
+    double sigma;       /* full3 filter width, > 0 (default 0.4) */
+    int threads;        /* worker threads for this call; 0 = default */
+} pr_options;
+
+void pr_default_options(pr_options* options);
+
+/* rotation of roll degrees about X, then pitch about Y, then yaw about Z;
+   the same matrix as 'panorotate <roll> <pitch> <yaw>' uses */
+void pr_rotation(double matrix[9], double roll, double pitch, double yaw);
+
+/* renders src rotated by the row major 3x3 matrix into dst; dst may be a
+   different size and format than src. options may be null. */
+pr_status pr_rotate(const pr_image* src, const pr_image* dst,
+    const double matrix[9], const pr_options* options);
+
+const char* pr_status_string(pr_status status);
+
+#ifdef __cplusplus
+}
+#endif
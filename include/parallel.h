@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <algorithm>
+
+// holds tiles back until what they depend on is available (for example
+// source rows that are still being decoded, see row_progress.h)
+struct TileGate
+{
+    virtual ~TileGate() {}
+    
+    // how far the work a tile depends on must have got; tiles are handed
+    // out in increasing order of need
+    virtual size_t need(size_t x0, size_t y0, size_t x1, size_t y1) const = 0;
+    
+    // blocks until need is met; false means it never will be and the
+    // tile is skipped
+    virtual bool wait(size_t need) const = 0;
+};
+
+// how the remap engines divide output pixels between threads
+struct TileSchedule
+{
+    enum Kind
+    {
+        STATIC_ROWS,    // OpenMP default: one block of rows per thread
+        DYNAMIC_TILES   // threads pull small tiles from a shared counter
+    };
+    
+    Kind kind;
+    size_t tile_width;
+    size_t tile_height;
+    
+    // tile coordinates passed to the gate are those of the whole image
+    // when only rows gate_row_offset and up are being worked on
+    const TileGate* gate;
+    size_t gate_row_offset;
+    
+    TileSchedule() : kind(DYNAMIC_TILES), tile_width(64), tile_height(8),
+        gate(0), gate_row_offset(0) {}
+};
+
+struct GatedTile
+{
+    size_t x0, y0, x1, y1;
+    size_t need;
+    
+    bool operator<(const GatedTile& other) const
+    {
+        return need < other.need;
+    }
+};
+
+// parallel_tiles with a gate: each thread takes the tile with the
+// smallest need left and waits for it, so the tiles that can go first
+// do, wherever they are in the image. Static rows become one row tiles.
+template<typename F>
+void parallel_gated_tiles(size_t width, size_t height, 
+    const TileSchedule& sched, F func)
+{
+    bool rows = sched.kind == TileSchedule::STATIC_ROWS;
+    
+    size_t tw = !rows && sched.tile_width  ? sched.tile_width  : width;
+    size_t th = !rows && sched.tile_height ? sched.tile_height : 1;
+    
+    std::vector<GatedTile> tiles;
+    
+    for(size_t y0 = 0; y0 < height; y0 += th)
+    for(size_t x0 = 0; x0 < width; x0 += tw)
+    {
+        GatedTile tile;
+        tile.x0 = x0;
+        tile.y0 = y0;
+        tile.x1 = x0 + tw < width  ? x0 + tw : width;
+        tile.y1 = y0 + th < height ? y0 + th : height;
+        tile.need = sched.gate->need(tile.x0, tile.y0 + sched.gate_row_offset,
+            tile.x1, tile.y1 + sched.gate_row_offset);
+        
+        tiles.push_back(tile);
+    }
+    
+    // equal needs keep their row-major order
+    std::stable_sort(tiles.begin(), tiles.end());
+    
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(long t = 0; t < (long)tiles.size(); t++)
+    {
+        const GatedTile& tile = tiles[t];
+        
+        if(sched.gate->wait(tile.need))
+            func(tile.x0, tile.y0, tile.x1, tile.y1);
+    }
+}
+
+// calls func(x0, y0, x1, y1) for every tile of a width x height image,
+// distributing the tiles over the OpenMP threads according to sched
+template<typename F>
+void parallel_tiles(size_t width, size_t height, const TileSchedule& sched,
+    F func)
+{
+    if(sched.gate)
+    {
+        parallel_gated_tiles(width, height, sched, func);
+        return;
+    }
+    
+    if(sched.kind == TileSchedule::STATIC_ROWS)
+    {
+        #pragma omp parallel for
+        for(long y = 0; y < (long)height; y++)
+        {
+            func((size_t)0, (size_t)y, width, (size_t)y+1);
+        }
+        
+        return;
+    }
+    
+    size_t tw = sched.tile_width  ? sched.tile_width  : width;
+    size_t th = sched.tile_height ? sched.tile_height : 1;
+    
+    size_t tiles_x = (width  + tw - 1) / tw;
+    size_t tiles_y = (height + th - 1) / th;
+    long tile_count = tiles_x * tiles_y;
+    
+    // tiles are handed out one at a time in row-major order so that
+    // neighbouring threads work on nearby parts of the source
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(long t = 0; t < tile_count; t++)
+    {
+        size_t x0 = (t % tiles_x) * tw;
+        size_t y0 = (t / tiles_x) * th;
+        size_t x1 = x0 + tw < width  ? x0 + tw : width;
+        size_t y1 = y0 + th < height ? y0 + th : height;
+        
+        func(x0, y0, x1, y1);
+    }
+}
+
+// parses "static" or "dynamic[:WxH]"
+bool parse_schedule(TileSchedule& out, const std::string& text);
+
+const char* schedule_name(const TileSchedule& sched);
+
+// number of threads used by the following parallel regions
+void set_thread_count(int threads);
+int thread_count();
+
+// parses "compact", "spread" or a cpu list such as "0-7,16,18"
+bool parse_affinity(std::vector<int>& cpus, const std::string& text);
+
+// pins OpenMP thread i to cpus[i % cpus.size()]
+bool pin_threads(const std::vector<int>& cpus);
+
+// OpenMP thread 0 is the main thread, so after pin_threads every
+// std::thread it starts (and any OpenMP team that thread starts) would be
+// stuck on cpus[0]. Threads call this first to move to the whole list
+// passed to pin_threads instead; their own teams then share those cpus
+// without being pinned one to one. Without pinning it does nothing.
+void unpin_thread();
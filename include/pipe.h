@@ -0,0 +1,36 @@
+#pragma once
+
+#include "custom_math.h"
+#include "remap.h"
+
+#include <string>
+
+// raw frame layouts accepted on stdin and written to stdout; these match
+// the ffmpeg pixel formats of the same name
+enum PipeFormat
+{
+    PIPE_RGB24,     // 8-bit RGB
+    PIPE_RGB48,     // 16-bit little endian RGB (rgb48le)
+    PIPE_RGBA       // 8-bit RGBA
+};
+
+struct PipeParams
+{
+    PipeFormat format;
+    size_t width;           // input frame size
+    size_t height;
+    size_t output_width;    // output frame size
+    size_t output_height;
+    
+    PipeParams() : format(PIPE_RGB24), width(0), height(0), 
+        output_width(0), output_height(0) {}
+};
+
+bool parse_pipe_format(PipeFormat& out, const std::string& name);
+
+// reads raw frames from stdin until it ends and writes each one rotated
+// by rot to stdout. Reading the next frame and writing the previous one
+// overlap the remap of the current frame, and the engine's tables are
+// kept from frame to frame.
+bool run_pipe(const PipeParams& params, Mat3 rot, 
+    const RemapParams& remap_params);
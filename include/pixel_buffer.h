@@ -0,0 +1,140 @@
+#pragma once
+
+// Caller owned pixel storage, as used by the library API (panorotate.h).
+// Each channel is addressed through its own base pointer plus byte
+// strides, so interleaved and planar layouts are read and written the
+// same way and never need to be copied into an Image first.
+
+#include "image.h"
+
+#include <cstring>
+#include <stdint.h>
+
+enum PixelFormat
+{
+    PIXEL_U8,       // unsigned integers scaled to 0.0 - 1.0
+    PIXEL_U16,
+    PIXEL_F16,      // IEEE half and single floats, unscaled
+    PIXEL_F32
+};
+
+struct PixelBuffer
+{
+    size_t width;
+    size_t height;
+    int channels;               // 3 or 4; 3 channel sources have alpha 1.0
+    PixelFormat format;
+    unsigned char* planes[4];   // channel c of pixel (0, 0)
+    size_t pixel_stride;        // bytes from one pixel to the next
+    size_t row_stride;          // bytes from one row to the next
+    
+    PixelBuffer() : width(0), height(0), channels(4), format(PIXEL_U8),
+        planes{0, 0, 0, 0}, pixel_stride(0), row_stride(0) {}
+    
+    unsigned char* sample(size_t x, size_t y, int c) const
+    {
+        return planes[c] + row_stride*y + pixel_stride*x;
+    }
+};
+
+// strides are arbitrary, so samples may be unaligned and go via memcpy
+template<PixelFormat F>
+inline double read_sample(const unsigned char* p);
+
+template<>
+inline double read_sample<PIXEL_U8>(const unsigned char* p)
+{
+    return *p / (double)0xFF;
+}
+
+template<>
+inline double read_sample<PIXEL_U16>(const unsigned char* p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v / (double)0xFFFF;
+}
+
+template<>
+inline double read_sample<PIXEL_F16>(const unsigned char* p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return half_to_float(v);
+}
+
+template<>
+inline double read_sample<PIXEL_F32>(const unsigned char* p)
+{
+    float v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// integer formats are clamped to 0..1 and truncated like save_tiff()
+inline void write_sample(PixelFormat format, unsigned char* p, double v)
+{
+    if(format == PIXEL_U8 || format == PIXEL_U16)
+    {
+        if(v < 0.0)
+            v = 0.0;
+        if(v > 1.0)
+            v = 1.0;
+    }
+    
+    switch(format)
+    {
+        case PIXEL_U8:
+            *p = 0xFF * v;
+            break;
+        
+        case PIXEL_U16:
+        {
+            uint16_t s = 0xFFFF * v;
+            memcpy(p, &s, sizeof(s));
+            break;
+        }
+        
+        case PIXEL_F16:
+        {
+            uint16_t s = float_to_half(v);
+            memcpy(p, &s, sizeof(s));
+            break;
+        }
+        
+        case PIXEL_F32:
+        {
+            float s = v;
+            memcpy(p, &s, sizeof(s));
+            break;
+        }
+    }
+}
+
+// a PixelBuffer with its format fixed at compile time, so the remap
+// kernels can sample it without a per-sample format switch
+template<PixelFormat F>
+struct SourceBuffer : public PixelBuffer
+{
+    explicit SourceBuffer(const PixelBuffer& buffer) : PixelBuffer(buffer) {}
+    
+    RGBAF get(size_t x, size_t y) const
+    {
+        return RGBAF(
+            read_sample<F>(sample(x, y, 0)),
+            read_sample<F>(sample(x, y, 1)),
+            read_sample<F>(sample(x, y, 2)),
+            channels == 4 ? read_sample<F>(sample(x, y, 3)) : 1.0);
+    }
+};
+
+inline void store_pixel(const PixelBuffer& onto, size_t x, size_t y,
+    const RGBAF& p)
+{
+    write_sample(onto.format, onto.sample(x, y, 0), p.r);
+    write_sample(onto.format, onto.sample(x, y, 1), p.g);
+    write_sample(onto.format, onto.sample(x, y, 2), p.b);
+    
+    if(onto.channels == 4)
+        write_sample(onto.format, onto.sample(x, y, 3), p.a);
+}
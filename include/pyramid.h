@@ -0,0 +1,31 @@
+#pragma once
+
+#include "image.h"
+#include "remap.h"
+
+#include <string>
+
+enum PyramidLayout
+{
+    PYRAMID_DEEPZOOM,   // <base>.dzi + <base>_files/<level>/<col>_<row>.jpg
+    PYRAMID_XYZ         // <base>/<z>/<x>/<y>.jpg, z = 0 is one tile
+};
+
+struct PyramidParams
+{
+    PyramidLayout layout;
+    size_t tile_size;   // must be even
+    int quality;        // JPEG quality of the tiles
+    
+    PyramidParams() : layout(PYRAMID_DEEPZOOM), tile_size(256), quality(90) {}
+};
+
+bool parse_pyramid_layout(PyramidLayout& out, const std::string& name);
+
+// renders from rotated by rot into a width x height tile pyramid. The full
+// resolution level is rendered one row of tiles at a time and each coarser
+// level is built from the finer rows while they are still in memory, so
+// only about two rows of tiles per level are held at once.
+bool render_pyramid(const Image<RGBAF>& from, Mat3 rot, 
+    const RemapParams& remap_params, size_t width, size_t height,
+    const PyramidParams& params, const std::string& base);
@@ -1,5 +1,137 @@
+#pragma once
+
 #include "image.h"
 #include "custom_math.h"
+#include "parallel.h"
+#include "tiled_image.h"
+#include "pixel_buffer.h"
+#include "source_window.h"
+#include "area_table.h"
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cmath>
+
+// a perspective (rectilinear) camera looking into the panorama
+struct Viewport
+{
+    Mat3 rot;               // camera orientation; looks down +X by default
+    double hfov;            // horizontal field of view in radians
+    Image<RGBAF>* onto;     // output; its size sets the view resolution
+    
+    Viewport() : rot(ident()), hfov(M_PI/2), onto(0) {}
+};
+
+enum RemapEngine
+{
+    ENGINE_FULL3,   // supersampled gaussian filter (remap_full3)
+    ENGINE_FAST,    // single bilinear sample per pixel (remap_fast)
+    ENGINE_AREA     // footprint box averaged from a summed-area table
+};
+
+struct CoverageMask;
+
+// what the engines can keep between remaps that render the same output
+// size with the same params, such as the frames of run_pipe: the
+// direction tables and the storage of the area engine's summed-area
+// table (which still has to be rebuilt for every source). One caller at
+// a time.
+struct RemapCache
+{
+    std::deque<LL2Vec3_Table> tables;
+    SummedAreaTable sat;
+    
+    // the table of a width x height output with subpixels per pixel,
+    // built on first use
+    const LL2Vec3_Table& table(int width, int height, int subpixels);
+};
+
+// tuning knobs shared by the remap engines
+struct RemapParams
+{
+    RemapEngine engine;     // used by remap() to pick the engine
+    int samples;            // subsamples per axis for remap_full3 (odd)
+    double sigma;           // gaussian filter width used by remap_full3
+    double prune_epsilon;   // filter taps with less weight are skipped
+    int channels;           // 3 = source alpha is all 1.0 and is skipped
+    TileSchedule schedule;  // how output pixels are split between threads
+    
+    // band rendering: the onto image holds rows row_offset and up of an
+    // output that is output_height rows tall (0 = onto is the whole output)
+    size_t row_offset;
+    size_t output_height;
+    
+    // alpha coverage of the source (coverage_mask.h), or 0; remap_full3
+    // fills tiles that only see empty blocks and skips the alpha of tiles
+    // that only see opaque ones
+    const CoverageMask* coverage;
+    
+    // tables kept between calls, or 0 to build them for every call
+    RemapCache* cache;
+    
+    RemapParams() : engine(ENGINE_FULL3), samples(9), sigma(0.4), 
+        prune_epsilon(1e-4), channels(4), row_offset(0), output_height(0),
+        coverage(0), cache(0) {}
+    
+    template<typename Dst>
+    size_t full_height(const Dst& onto) const
+    {
+        return output_height ? output_height : onto.height;
+    }
+};
+
+bool parse_engine(RemapEngine& out, const std::string& name);
+const char* engine_name(RemapEngine engine);
+
+// runs the engine selected by params.engine
+void remap(
+    Image<RGBAF>& onto,
+    const Image<RGBAF>& from,
+    Mat3 rot,
+    const RemapParams& params);
+
+// same, sampling a source stored in tiles (see tiled_image.h)
+void remap(
+    Image<RGBAF>& onto,
+    const TiledImage<RGBAF>& from,
+    Mat3 rot,
+    const RemapParams& params);
+
+// same, sampling only the source rows held by a window (source_window.h)
+void remap(
+    Image<RGBAF>& onto,
+    const SourceWindow& from,
+    Mat3 rot,
+    const RemapParams& params);
+
+// rotations that move every pixel center of a width x height panorama
+// exactly onto another one (yaws by whole columns, optionally combined
+// with a 180 degree roll or pitch). Output pixel (x, y) is then source
+// column x + shift of row y, or with mirror set, column shift - x of row
+// height-1-y, taken modulo width-1 (columns 0 and width-1 are the same
+// meridian). remap() copies these pixels instead of filtering them
+// whenever the output is the source size.
+struct LatticePermutation
+{
+    bool mirror;
+    size_t shift;
+};
+
+bool lattice_permutation(Mat3 rot, size_t width, size_t height,
+    LatticePermutation& out);
+
+// the fractions of the source height (row / (source height-1)) that
+// output rows first_row .. end_row-1 of an output output_height rows
+// tall can sample, whatever the output and source widths
+void source_row_range(Mat3 rot, size_t output_height, size_t first_row,
+    size_t end_row, double& top, double& bottom);
+
+// how many source rows, counted from the top, output tile x0..x1-1,
+// y0..y1-1 of an output_width x output_height output can sample
+size_t source_rows_needed(Mat3 rot, size_t output_width, 
+    size_t output_height, size_t source_height, size_t x0, size_t y0,
+    size_t x1, size_t y1);
 
 // current best quality method
 void remap_full3(
@@ -8,12 +140,101 @@ void remap_full3(
     Mat3 rot = ident(),
     const double s = 0.4);
 
+void remap_full3(
+    Image<RGBAF>& onto,
+    const Image<RGBAF>& from,
+    Mat3 rot,
+    const RemapParams& params);
+
+void remap_full3(
+    Image<RGBAF>& onto,
+    const TiledImage<RGBAF>& from,
+    Mat3 rot,
+    const RemapParams& params);
+
 // single sample per pixel to produce a quick result for preview
 void remap_fast(Image<RGBAF>& onto, const Image<RGBAF>& from, Mat3 rot);
 
+void remap_fast(
+    Image<RGBAF>& onto,
+    const Image<RGBAF>& from,
+    Mat3 rot,
+    const RemapParams& params);
+
+void remap_fast(
+    Image<RGBAF>& onto,
+    const TiledImage<RGBAF>& from,
+    Mat3 rot,
+    const RemapParams& params);
+
+// renders from once per rotation in a single pass: onto[k] receives the
+// source rotated by rots[k]. All outputs must be the same size; they share
+// one direction table, filter and traversal of the output pixels.
+void remap_multi(
+    std::vector<Image<RGBAF>*>& onto,
+    const Image<RGBAF>& from,
+    const std::vector<Mat3>& rots,
+    const RemapParams& params);
+
+// same, reading and writing caller owned pixels in their own formats and
+// layouts; used by the library API. onto and from must not overlap.
+void remap(
+    const PixelBuffer& onto,
+    const PixelBuffer& from,
+    Mat3 rot,
+    const RemapParams& params);
+
+// renders the width x height output of remap() in bands of band_rows rows
+// and hands each finished band to writer, which encodes it on its own
+// thread while the next band is rendered. Only two bands are held in
+// memory. Returns false if the writer failed. With params.output_height
+// set, the height rows are rows params.row_offset and up of that output.
+bool remap_streamed(
+    RowWriter& writer,
+    const Image<RGBAF>& from,
+    Mat3 rot,
+    const RemapParams& params,
+    size_t width,
+    size_t height,
+    size_t band_rows = 64);
+
+bool remap_streamed(
+    RowWriter& writer,
+    const TiledImage<RGBAF>& from,
+    Mat3 rot,
+    const RemapParams& params,
+    size_t width,
+    size_t height,
+    size_t band_rows = 64);
+
+bool remap_streamed(
+    RowWriter& writer,
+    const SourceWindow& from,
+    Mat3 rot,
+    const RemapParams& params,
+    size_t width,
+    size_t height,
+    size_t band_rows = 64);
+
+bool remap_streamed(
+    RowWriter& writer,
+    const PixelBuffer& from,
+    Mat3 rot,
+    const RemapParams& params,
+    size_t width,
+    size_t height,
+    size_t band_rows = 64);
+
 // original implementation -- only included still for quality comparison
 void remap_full1(
     Image<RGBAF>& onto, 
     const Image<RGBAF>& from, 
     Mat3 rot = ident());
 
+// renders every view from the same source in one parallel pass; rot is
+// applied after each view's own orientation (same meaning as remap_full3)
+void remap_rectilinear(
+    std::vector<Viewport>& views,
+    const Image<RGBAF>& from,
+    Mat3 rot = ident(),
+    const double s = 0.4);
@@ -0,0 +1,445 @@
+#pragma once
+
+// Remap kernels specialized at compile time by channel count, so 3
+// channel sources never touch alpha. The sample grid is a runtime list of
+// the taps left after pruning (see prune_taps).
+
+#include "image.h"
+#include "custom_math.h"
+#include "remap.h"
+#include "tiled_image.h"
+#include "pixel_buffer.h"
+#include "area_table.h"
+#include "coverage_mask.h"
+
+#include <cmath>
+#include <vector>
+
+// converts a (unit) direction into equirectangular pixel coordinates of
+// a width x height source, clamped to the valid sampling range
+inline void vec3_to_src(const Vec3& v, size_t width, size_t height,
+    double& src_x, double& src_y)
+{
+    LatLong LL_src = vec3_to_latlong(v);
+    
+    src_x = LL_src.long_ / (2*M_PI) * (width-1);
+    src_y = (M_PI - (LL_src.lat+(M_PI/2)))/ M_PI * (height-1);
+    
+    if(src_x > width-1)
+        src_x = width - 1;
+    if(src_y > height-1)
+        src_y = height - 1;
+    if(src_x < 0)
+        src_x = 0;
+    if(src_y < 0)
+        src_y = 0;
+}
+
+// gaussian weights for an n x n grid of subsamples, normalized to sum to
+// one
+inline void grid_weights(double* weights, int n, double sigma)
+{
+    double sum = 0.0;
+    
+    for(int i = 0; i < n*n; i++)
+    {
+        double x = i % n - (n-1)/2.0;
+        double y = i / n - (n-1)/2.0;
+        
+        weights[i] = exp(-(x*x + y*y)/(2*sigma));
+        sum += weights[i];
+    }
+    
+    for(int i = 0; i < n*n; i++)
+    {
+        weights[i] /= sum;
+    }
+}
+
+// compacts the taps of an n x n weight grid whose normalized weight is at
+// least epsilon to the front of tap_x/tap_y/tap_weight, renormalizing what
+// is left. Returns the number of taps kept (always at least the center).
+inline int prune_taps(const double* weights, int n, double epsilon,
+    int* tap_x, int* tap_y, double* tap_weight)
+{
+    int count = 0;
+    double sum = 0.0;
+    
+    for(int i = 0; i < n*n; i++)
+    {
+        if(weights[i] < epsilon && i != (n*n)/2)
+            continue;
+        
+        tap_x[count] = i % n;
+        tap_y[count] = i / n;
+        tap_weight[count] = weights[i];
+        sum += weights[i];
+        count++;
+    }
+    
+    for(int i = 0; i < count; i++)
+    {
+        tap_weight[i] /= sum;
+    }
+    
+    return count;
+}
+
+// pixel addressing for each source layout the kernels can sample
+template<typename T>
+inline const T& source_pixel(const Image<T>& src, size_t x, size_t y)
+{
+    return src.values[src.width*y + x];
+}
+
+template<typename T>
+inline const T& source_pixel(const TiledImage<T>& src, size_t x, size_t y)
+{
+    return src.get(x, y);
+}
+
+template<PixelFormat F>
+inline RGBAF source_pixel(const SourceBuffer<F>& src, size_t x, size_t y)
+{
+    return src.get(x, y);
+}
+
+inline const RGBAF& source_pixel(const SourceWindow& src, size_t x, size_t y)
+{
+    return src.get(x, y);
+}
+
+// and for each kind of output
+inline void store_pixel(Image<RGBAF>& onto, size_t x, size_t y, 
+    const RGBAF& p)
+{
+    onto.values[onto.width*y + x] = p;
+}
+
+// adds weight * bilinear(src, x, y) to acc[0..CH-1]; x and y must already
+// be clamped to the image. Same arithmetic as bilinear_get().
+template<int CH, typename Src>
+inline void accumulate_bilinear(const Src& src, double x, double y,
+    double weight, double* acc)
+{
+    size_t x0 = (size_t)floor(x);
+    size_t y0 = (size_t)floor(y);
+    size_t x1 = (size_t)ceil(x);
+    size_t y1 = (size_t)ceil(y);
+    
+    if(x1 >= src.width)
+        x1 = src.width - 1;
+    if(y1 >= src.height)
+        y1 = src.height - 1;
+    
+    double fx = x - x0;
+    double fy = y - y0;
+    
+    const RGBAF& A = source_pixel(src, x0, y0);
+    const RGBAF& B = source_pixel(src, x1, y0);
+    const RGBAF& C = source_pixel(src, x0, y1);
+    const RGBAF& D = source_pixel(src, x1, y1);
+    
+    acc[0] += weight * ((1-fy)*((1-fx)*A.r + fx*B.r) + 
+                           fy *((1-fx)*C.r + fx*D.r));
+    acc[1] += weight * ((1-fy)*((1-fx)*A.g + fx*B.g) + 
+                           fy *((1-fx)*C.g + fx*D.g));
+    acc[2] += weight * ((1-fy)*((1-fx)*A.b + fx*B.b) + 
+                           fy *((1-fx)*C.b + fx*D.b));
+    
+    if(CH == 4)
+    {
+        acc[3] += weight * ((1-fy)*((1-fx)*A.a + fx*B.a) + 
+                               fy *((1-fx)*C.a + fx*D.a));
+    }
+}
+
+template<int CH>
+inline RGBAF make_pixel(const double* acc)
+{
+    return RGBAF(acc[0], acc[1], acc[2], CH == 4 ? acc[3] : 1.0);
+}
+
+// params.coverage if it was made from from, else 0 (the double rotation
+// test and --autotune remap their intermediates with the same params)
+template<typename Src>
+inline const CoverageMask* source_coverage(const Src& from, 
+    const RemapParams& params)
+{
+    const CoverageMask* mask = params.coverage;
+    
+    if(mask && mask->image != (const void*)&from)
+        return 0;
+    
+    return mask;
+}
+
+// coverage of the source pixels that output tile x0..x1, y0..y1 of onto
+// can sample; mixed without a mask
+template<typename Dst>
+inline Coverage remap_tile_coverage(const CoverageMask* mask, 
+    const Dst& onto, const Mat3& rot, const RemapParams& params,
+    size_t x0, size_t y0, size_t x1, size_t y1)
+{
+    if(!mask)
+        return COVERAGE_MIXED;
+    
+    return tile_coverage(*mask, rot, onto.width, params.full_height(onto),
+        x0, y0 + params.row_offset, x1, y1 + params.row_offset);
+}
+
+template<typename Dst>
+inline void fill_tile(Dst& onto, size_t x0, size_t y0, size_t x1, 
+    size_t y1, const RGBAF& p)
+{
+    for(size_t y = y0; y < y1; y++)
+    for(size_t x = x0; x < x1; x++)
+    {
+        store_pixel(onto, x, y, p);
+    }
+}
+
+// remap_full3 over the output rectangle x0..x1, y0..y1, evaluating only
+// the taps of the grid that survived pruning
+template<int CH, typename Src, typename Dst>
+void full3_tile(Dst& onto, const Src& from, const Mat3& rot,
+    const LL2Vec3_Table& table, int tap_count, const int* tap_x, 
+    const int* tap_y, const double* tap_weight, size_t row_offset,
+    size_t x0, size_t y0, size_t x1, size_t y1)
+{
+    for(size_t y = y0; y < y1; y++)
+    for(size_t x = x0; x < x1; x++)
+    {
+        double acc[4] = {0.0, 0.0, 0.0, 0.0};
+        
+        for(int i = 0; i < tap_count; i++)
+        {
+            Vec3 v = table.lookup(x, tap_x[i], y + row_offset, tap_y[i]);
+            v = rot * v;
+            
+            double src_x, src_y;
+            vec3_to_src(v, from.width, from.height, src_x, src_y);
+            
+            accumulate_bilinear<CH>(from, src_x, src_y, tap_weight[i], acc);
+        }
+        
+        store_pixel(onto, x, y, make_pixel<CH>(acc));
+    }
+}
+
+template<int CH, typename Src, typename Dst>
+void full3_kernel(Dst& onto, const Src& from, Mat3 rot,
+    const RemapParams& params)
+{
+    const int n = params.samples;
+    
+    RemapCache own;
+    RemapCache& cache = params.cache ? *params.cache : own;
+    const LL2Vec3_Table& table = cache.table(onto.width, 
+        params.full_height(onto), n);
+    
+    std::vector<double> weights(n*n);
+    grid_weights(&weights[0], n, params.sigma);
+    
+    std::vector<int> tap_x(n*n);
+    std::vector<int> tap_y(n*n);
+    std::vector<double> tap_weight(n*n);
+    
+    int tap_count = prune_taps(&weights[0], n, params.prune_epsilon, 
+        &tap_x[0], &tap_y[0], &tap_weight[0]);
+    
+    // a 3 channel source has no empty parts to skip
+    const CoverageMask* mask = CH == 4 ? source_coverage(from, params) : 0;
+    
+    parallel_tiles(onto.width, onto.height, params.schedule,
+        [&](size_t x0, size_t y0, size_t x1, size_t y1)
+    {
+        switch(remap_tile_coverage(mask, onto, rot, params, x0, y0, x1, y1))
+        {
+            case COVERAGE_EMPTY:
+                fill_tile(onto, x0, y0, x1, y1, RGBAF(0, 0, 0, 0));
+                break;
+            
+            case COVERAGE_OPAQUE:
+                full3_tile<3>(onto, from, rot, table, tap_count, &tap_x[0],
+                    &tap_y[0], &tap_weight[0], params.row_offset, 
+                    x0, y0, x1, y1);
+                break;
+            
+            case COVERAGE_MIXED:
+                full3_tile<CH>(onto, from, rot, table, tap_count, &tap_x[0],
+                    &tap_y[0], &tap_weight[0], params.row_offset, 
+                    x0, y0, x1, y1);
+                break;
+        }
+    });
+}
+
+template<int CH, typename Src, typename Dst>
+void fast_kernel(Dst& onto, const Src& from, Mat3 rot,
+    const RemapParams& params)
+{
+    RemapCache own;
+    RemapCache& cache = params.cache ? *params.cache : own;
+    const LL2Vec3_Table& table = cache.table(onto.width, 
+        params.full_height(onto), 3);
+    
+    parallel_tiles(onto.width, onto.height, params.schedule,
+        [&](size_t x0, size_t y0, size_t x1, size_t y1)
+    {
+        for(size_t y = y0; y < y1; y++)
+        for(size_t x = x0; x < x1; x++)
+        {
+            Vec3 v = table.lookup(x, 1, y + params.row_offset, 1);
+            v = rot * v;
+            
+            double src_x, src_y;
+            vec3_to_src(v, from.width, from.height, src_x, src_y);
+            
+            double acc[4] = {0.0, 0.0, 0.0, 0.0};
+            accumulate_bilinear<CH>(from, src_x, src_y, 1.0, acc);
+            
+            store_pixel(onto, x, y, make_pixel<CH>(acc));
+        }
+    });
+}
+
+// renders the output rectangle x0..x1, y0..y1 of every onto[k] rotated by
+// rots[k]. Each tap direction is looked up once and shared by all of the
+// rotations; acc must hold 4 * rots.size() doubles.
+template<int CH, typename Src>
+void multi_tile(Image<RGBAF>* const* onto, const Src& from, 
+    const Mat3* rots, size_t count, const LL2Vec3_Table& table,
+    int tap_count, const int* tap_x, const int* tap_y, 
+    const double* tap_weight, size_t row_offset, double* acc,
+    size_t x0, size_t y0, size_t x1, size_t y1)
+{
+    for(size_t y = y0; y < y1; y++)
+    for(size_t x = x0; x < x1; x++)
+    {
+        for(size_t k = 0; k < 4*count; k++)
+        {
+            acc[k] = 0.0;
+        }
+        
+        for(int i = 0; i < tap_count; i++)
+        {
+            const Vec3 v = table.lookup(x, tap_x[i], y + row_offset, 
+                tap_y[i]);
+            
+            for(size_t k = 0; k < count; k++)
+            {
+                double src_x, src_y;
+                vec3_to_src(rots[k] * v, from.width, from.height, 
+                    src_x, src_y);
+                
+                accumulate_bilinear<CH>(from, src_x, src_y, tap_weight[i], 
+                    acc + 4*k);
+            }
+        }
+        
+        for(size_t k = 0; k < count; k++)
+        {
+            onto[k]->values[onto[k]->width*y + x] = 
+                make_pixel<CH>(acc + 4*k);
+        }
+    }
+}
+
+// area engine: each output pixel's corners, edge midpoints and center are
+// projected into the source and the bounding box of those points is
+// averaged from the summed-area table, in constant time per pixel
+template<typename Dst>
+void area_kernel(Dst& onto, const SummedAreaTable& sat, Mat3 rot,
+    const RemapParams& params)
+{
+    RemapCache own;
+    RemapCache& cache = params.cache ? *params.cache : own;
+    const LL2Vec3_Table& table = cache.table(onto.width, 
+        params.full_height(onto), 3);
+    
+    const double period = sat.period;
+    
+    parallel_tiles(onto.width, onto.height, params.schedule,
+        [&](size_t x0, size_t y0, size_t x1, size_t y1)
+    {
+        for(size_t y = y0; y < y1; y++)
+        for(size_t x = x0; x < x1; x++)
+        {
+            double cx, cy;
+            vec3_to_src(rot * table.lookup(x, 1, y + params.row_offset, 1),
+                sat.width, sat.height, cx, cy);
+            
+            double min_x = cx, max_x = cx;
+            double min_y = cy, max_y = cy;
+            
+            for(int i = 0; i < 9; i++)
+            {
+                double px, py;
+                vec3_to_src(
+                    rot * table.lookup(x, i % 3, y + params.row_offset, i / 3),
+                    sat.width, sat.height, px, py);
+                
+                // take the short way around the seam
+                if(px - cx > period / 2)
+                    px -= period;
+                else if(cx - px > period / 2)
+                    px += period;
+                
+                min_x = px < min_x ? px : min_x;
+                max_x = px > max_x ? px : max_x;
+                min_y = py < min_y ? py : min_y;
+                max_y = py > max_y ? py : max_y;
+            }
+            
+            // a footprint this wide surrounds a pole: every longitude
+            // down to the edge of the image is covered
+            if(max_x - min_x > period / 2)
+            {
+                min_x = cx - period / 2;
+                max_x = cx + period / 2;
+                
+                if(cy < sat.height / 2.0)
+                    min_y = -0.5;
+                else
+                    max_y = sat.height - 0.5;
+            }
+            
+            store_pixel(onto, x, y, sat.box(min_x, min_y, max_x, max_y));
+        }
+    });
+}
+
+// a parallel gather for rotations that permute the pixel centers (see
+// LatticePermutation); no resampling, so the output is bit exact
+template<typename Src, typename Dst>
+void permute_kernel(Dst& onto, const Src& from,
+    const LatticePermutation& perm, const RemapParams& params)
+{
+    const size_t period = from.width - 1;
+    
+    parallel_tiles(onto.width, onto.height, params.schedule,
+        [&](size_t x0, size_t y0, size_t x1, size_t y1)
+    {
+        for(size_t y = y0; y < y1; y++)
+        {
+            size_t row = y + params.row_offset;
+            
+            if(perm.mirror)
+                row = from.height - 1 - row;
+            
+            for(size_t x = x0; x < x1; x++)
+            {
+                // columns 0 and period are the same meridian; keep every
+                // column that lands in range so identity is a plain copy
+                size_t column = perm.mirror ?
+                    perm.shift + period - x : x + perm.shift;
+                
+                if(column > period)
+                    column -= period;
+                
+                store_pixel(onto, x, y, source_pixel(from, column, row));
+            }
+        }
+    });
+}
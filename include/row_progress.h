@@ -0,0 +1,81 @@
+#pragma once
+
+// Remapping while the source is still being decoded. BackgroundLoad runs
+// load() on its own thread and the loader reports each run of finished
+// rows to a RowProgress. A SourceRowGate in the remap's TileSchedule then
+// holds every output tile back until the source rows it can sample are
+// in, and hands out the tiles that need the fewest rows first. JPEG and
+// PNG decode on a single thread, so the remap threads work through the
+// top of the output while the rest of the source is being decoded.
+
+#include "image.h"
+#include "parallel.h"
+#include "custom_math.h"
+#include "coverage_mask.h"
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct RowProgress : public RowListener
+{
+    std::mutex lock;
+    std::condition_variable changed;
+    
+    ImageLoadResult info;
+    bool sized;
+    size_t ready;       // rows of the image that are final
+    bool done;          // the load has returned
+    
+    // if set, the alpha coverage of an image that is not plain RGB is
+    // built as its rows come in
+    CoverageMask* coverage;
+    const Image<RGBAF>* image;
+    
+    RowProgress() : sized(false), ready(0), done(false), coverage(0),
+        image(0) {}
+    
+    void image_sized(const ImageLoadResult& info);
+    void rows_ready(size_t rows);
+    
+    // called once the load has returned, with its result
+    void finish(bool ok);
+    
+    // block until the image is sized, or until rows rows are in. Both
+    // return false if the load failed first.
+    bool wait_sized(ImageLoadResult& out);
+    bool wait_rows(size_t rows);
+};
+
+struct BackgroundLoad
+{
+    RowProgress progress;
+    ImageLoadResult result;
+    std::thread loader;
+    
+    // the load is waited for if it is still running
+    ~BackgroundLoad();
+    
+    // starts loading path into into; into must not be touched until
+    // progress says which rows are ready. With coverage given, it is
+    // sized and built as the rows come in unless the image is RGB.
+    void start(Image<RGBAF>& into, const std::string& path,
+        ImageLoadParams params, CoverageMask* coverage = 0);
+    
+    // waits for the load to return; false if it failed
+    bool finish();
+};
+
+// a TileGate for remapping from an image that a RowProgress reports on
+struct SourceRowGate : public TileGate
+{
+    RowProgress* progress;
+    Mat3 rot;
+    size_t output_width;
+    size_t output_height;
+    size_t source_height;
+    
+    size_t need(size_t x0, size_t y0, size_t x1, size_t y1) const;
+    bool wait(size_t need) const;
+};
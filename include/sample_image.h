@@ -0,0 +1,28 @@
+#pragma once
+
+// An image kept in the samples of its file (8 or 16-bit integers, half or
+// single floats) instead of RGBAF, so a source takes 3 to 16 bytes per
+// pixel instead of 32. The remap engines read it through its PixelBuffer
+// like any caller owned buffer.
+
+#include "image.h"
+#include "pixel_buffer.h"
+
+#include <vector>
+#include <string>
+
+struct SampleImage
+{
+    std::vector<unsigned char, ImageAllocator<unsigned char> > data;
+    PixelBuffer pixels;     // interleaved channels over data
+    
+    void resize(size_t width, size_t height, int channels,
+        PixelFormat format);
+};
+
+// the PixelFormat holding samples of an image file exactly
+PixelFormat sample_pixel_format(uint32_t bps, SampleFormat format);
+
+// same as load(), keeping the samples as they are in the file
+ImageLoadResult load_samples(SampleImage& into, const std::string& path,
+    const ImageLoadParams& params = ImageLoadParams());
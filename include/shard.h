@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// A shard is a TIFF holding output rows first_row .. first_row+rows-1 of
+// an output that is full_height rows tall. Shards of one render can be
+// made by separate processes or hosts (--band) and are assembled into the
+// final TIFF by merge_shards without any resampling.
+
+// parses a band given as "first:end" (rows first .. end-1)
+bool parse_band(size_t& first_row, size_t& end_row, const std::string& text);
+
+// the ImageDescription that marks a TIFF as a shard
+std::string shard_description(size_t first_row, size_t full_height);
+
+// copies the rows of every shard into one TIFF at path. The shards may
+// be given in any order but must be the same width and sample layout
+// and together cover every row exactly once.
+bool merge_shards(const std::vector<std::string>& shards,
+    const std::string& path);
@@ -0,0 +1,29 @@
+#pragma once
+
+// A horizontal slice of a remap source. When only a band of the output
+// is rendered, the rotation bounds the source rows it can sample (see
+// source_row_range in remap.h), so only those rows need to be decoded
+// and held. Coordinates are those of the whole source; rows outside the
+// slice read as the nearest row inside it.
+
+#include "image.h"
+
+struct SourceWindow
+{
+    Image<RGBAF> rows;      // source rows first_row and below
+    size_t width;           // of the whole source
+    size_t height;
+    size_t first_row;
+    
+    SourceWindow() : width(0), height(0), first_row(0) {}
+    
+    const RGBAF& get(size_t x, size_t y) const
+    {
+        size_t row = y > first_row ? y - first_row : 0;
+        
+        if(row >= rows.height)
+            row = rows.height - 1;
+        
+        return rows.values[rows.width*row + x];
+    }
+};
@@ -1,5 +1,21 @@
+#pragma once
+
 #include "image.h"
+#include "remap.h"
+#include "metrics.h"
+
+// rotates src by rot and back again and compares the result to src; an
+// error heatmap is written to heatmap when it is given
+ImageMetrics double_rotate_test(const Image<RGBAF>& src, Mat3 rot, 
+    bool preview_mode=false, const RemapParams& params = RemapParams(),
+    Image<RGBAF>* heatmap = 0);
 
-void double_rotate_test(const Image<RGBAF>& src, Mat3 rot, 
-    bool preview_mode=false);
+// times one remap of src at 1..64 threads with each tile schedule
+void scaling_test(const Image<RGBAF>& src, Mat3 rot,
+    bool preview_mode=false, const RemapParams& params = RemapParams());
 
+// times a band of remap output from the input scaled to 8K, 16K and 32K
+// wide, sampling it row major and from a TiledImage; sizes that don't fit
+// in memory twice over are skipped
+void layout_test(const Image<RGBAF>& src, Mat3 rot,
+    bool preview_mode=false, const RemapParams& params = RemapParams());
@@ -0,0 +1,60 @@
+#pragma once
+
+// Blocked storage for remap sources. A rotated equirectangular image is
+// read along curves that cross many rows; storing the pixels in 16x16
+// tiles (8 KiB of RGBAF) keeps the neighbourhood of a sample in a few
+// cache lines and one or two pages instead of one page per row.
+
+#include "image.h"
+
+template<typename T>
+struct TiledImage
+{
+    static const size_t TILE_BITS = 4;
+    static const size_t TILE = 1 << TILE_BITS;
+    static const size_t TILE_MASK = TILE - 1;
+    
+    // whole tiles, left to right, top to bottom
+    std::vector<T, ImageAllocator<T> > values;
+    size_t width;
+    size_t height;
+    size_t tiles_across;
+    
+    TiledImage() : width(0), height(0), tiles_across(0) {}
+    
+    size_t index(size_t x, size_t y) const
+    {
+        size_t tile = (y >> TILE_BITS) * tiles_across + (x >> TILE_BITS);
+        
+        return (tile << (2*TILE_BITS)) + 
+               ((y & TILE_MASK) << TILE_BITS) + (x & TILE_MASK);
+    }
+    
+    const T& get(size_t x, size_t y) const
+    {
+        return values[index(x, y)];
+    }
+    
+    // copies from into tiles; each thread fills whole rows of tiles so
+    // the pages it writes first are also the ones it owns (the allocator
+    // leaves them untouched until then)
+    void build(const Image<T>& from)
+    {
+        width = from.width;
+        height = from.height;
+        tiles_across = (width + TILE - 1) / TILE;
+        
+        const long tiles_down = (height + TILE - 1) / TILE;
+        values.resize(tiles_across * tiles_down * TILE * TILE);
+        
+        #pragma omp parallel for
+        for(long ty = 0; ty < tiles_down; ty++)
+        for(size_t y = ty * TILE; y < (ty+1) * TILE; y++)
+        for(size_t x = 0; x < tiles_across * TILE; x++)
+        {
+            // the padding of partial tiles is never sampled
+            ::new((void*)&values[index(x, y)]) T(
+                x < width && y < height ? from.values[width*y + x] : T());
+        }
+    }
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "image.h"
+#include "remap.h"
+
+#include <string>
+
+// searches sample counts, sigmas and engines for the fastest remap
+// settings whose round trip error on src meets min_psnr (mean PSNR in dB).
+// The schedule in base is kept. Returns false if no setting qualifies.
+bool autotune(RemapParams& out, const Image<RGBAF>& src, double min_psnr,
+    const RemapParams& base = RemapParams());
+
+// profiles are plain "key=value" text files; samples must be odd
+bool save_profile(const RemapParams& params, const std::string& path);
+bool load_profile(RemapParams& params, const std::string& path);
@@ -0,0 +1,266 @@
+#include "coverage_mask.h"
+#include "remap_kernel.h"
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+void CoverageMask::resize(const Image<RGBAF>& source)
+{
+    width = source.width;
+    height = source.height;
+    image = &source;
+    blocks_x = (width + BLOCK - 1) / BLOCK;
+    blocks_y = (height + BLOCK - 1) / BLOCK;
+    
+    blocks.assign(blocks_x * blocks_y, COVERAGE_MIXED);
+    rows_built.store(0);
+}
+
+void CoverageMask::build_rows(const Image<RGBAF>& from, size_t rows)
+{
+    size_t by = rows_built.load() / BLOCK;
+    
+    for(; by < blocks_y; by++)
+    {
+        size_t y0 = by * BLOCK;
+        size_t y1 = min(y0 + BLOCK, height);
+        
+        if(y1 > rows)
+            break;
+        
+        for(size_t bx = 0; bx < blocks_x; bx++)
+        {
+            size_t x0 = bx * BLOCK;
+            size_t x1 = min(x0 + BLOCK, width);
+            
+            bool empty = true;
+            bool opaque = true;
+            
+            for(size_t y = y0; y < y1 && (empty || opaque); y++)
+            for(size_t x = x0; x < x1; x++)
+            {
+                const RGBAF& p = from.values[from.width*y + x];
+                
+                if(p.a != 1.0)
+                    opaque = false;
+                if(p.a != 0.0 || p.r != 0.0 || p.g != 0.0 || p.b != 0.0)
+                    empty = false;
+            }
+            
+            blocks[blocks_x*by + bx] = empty  ? COVERAGE_EMPTY :
+                                       opaque ? COVERAGE_OPAQUE :
+                                                COVERAGE_MIXED;
+        }
+        
+        // the blocks are written before the rows are published
+        rows_built.store(y1, memory_order_release);
+    }
+}
+
+Coverage CoverageMask::region(long x0, size_t y0, long x1, size_t y1) const
+{
+    if(y1 >= rows_built.load(memory_order_acquire) || width < 2)
+        return COVERAGE_MIXED;
+    
+    // columns -1 and width-2 are the same pixel; a range that crosses
+    // the seam is split in two, and both edge columns (the same
+    // meridian) are read
+    const long period = width - 1;
+    long spans[2][2];
+    int span_count = 1;
+    
+    if(x1 - x0 + 1 >= period)
+    {
+        spans[0][0] = 0;
+        spans[0][1] = width - 1;
+    }
+    else
+    {
+        long k = x0 >= 0 ? x0 / period : -((-x0 + period - 1) / period);
+        
+        x0 -= k * period;
+        x1 -= k * period;
+        
+        spans[0][0] = x0;
+        spans[0][1] = min(x1, period);
+        
+        if(x1 >= period)
+        {
+            spans[0][1] = width - 1;
+            spans[1][0] = 0;
+            spans[1][1] = x1 - period;
+            span_count = 2;
+        }
+    }
+    
+    bool empty = false;
+    bool opaque = false;
+    
+    for(size_t by = y0 / BLOCK; by <= y1 / BLOCK; by++)
+    for(int s = 0; s < span_count; s++)
+    for(size_t bx = spans[s][0] / BLOCK; bx <= spans[s][1] / BLOCK; bx++)
+    {
+        switch(blocks[blocks_x*by + bx])
+        {
+            case COVERAGE_EMPTY:
+                empty = true;
+                break;
+            case COVERAGE_OPAQUE:
+                opaque = true;
+                break;
+            default:
+                return COVERAGE_MIXED;
+        }
+        
+        if(empty && opaque)
+            return COVERAGE_MIXED;
+    }
+    
+    return empty ? COVERAGE_EMPTY : COVERAGE_OPAQUE;
+}
+
+// output pixel coordinates of direction v in the output panorama; the
+// inverse of LL2Vec3_Table
+static void output_position(const Vec3& v, size_t output_width,
+    size_t output_height, double& x, double& y)
+{
+    LatLong LL = vec3_to_latlong(v);
+    
+    x = LL.long_ / (2*M_PI) * (output_width - 1.0);
+    y = (M_PI/2 - LL.lat) / M_PI * (output_height - 1.0);
+}
+
+Coverage tile_coverage(const CoverageMask& mask, Mat3 rot,
+    size_t output_width, size_t output_height, size_t x0, size_t y0,
+    size_t x1, size_t y1)
+{
+    if(output_width < 2 || output_height < 2 || mask.width < 2)
+        return COVERAGE_MIXED;
+    
+    // the tile's samples reach half a pixel past its outer pixel centers
+    const double left = x0 - 0.5;
+    const double right = x1 - 0.5;
+    const double top = y0 - 0.5;
+    const double bottom = y1 - 0.5;
+    
+    // samples past an output pole come back down on another meridian
+    if(top < 0 || bottom > output_height - 1.0)
+        return COVERAGE_MIXED;
+    
+    // a source pole inside the tile makes its footprint span every
+    // longitude. The source poles are the directions d with rot * d =
+    // (0, 0, +-1), which are +- the bottom row of rot.
+    const double out_period = output_width - 1.0;
+    
+    for(int sign = -1; sign <= 1; sign += 2)
+    {
+        Vec3 pole;
+        pole.x = sign * rot[6];
+        pole.y = sign * rot[7];
+        pole.z = sign * rot[8];
+        
+        double px, py;
+        output_position(pole, output_width, output_height, px, py);
+        
+        if(py < top - 1 || py > bottom + 1)
+            continue;
+        
+        for(int k = -1; k <= 1; k++)
+        {
+            double x = px + k * out_period;
+            
+            if(x >= left - 1 && x <= right + 1)
+                return COVERAGE_MIXED;
+        }
+    }
+    
+    // otherwise the footprint is bounded by the image of the tile's
+    // outline, which is walked in half pixel steps; source columns are
+    // unwrapped across the seam as it goes
+    const double period = mask.width - 1.0;
+    const double w = right - left;
+    const double h = bottom - top;
+    const size_t steps_x = (size_t)ceil(2 * w);
+    const size_t steps_y = (size_t)ceil(2 * h);
+    const size_t steps = 2 * (steps_x + steps_y);
+    
+    double min_x = 0, max_x = 0, min_y = 0, max_y = 0;
+    double last_x = 0, last_y = 0;
+    double max_step = 0;
+    
+    for(size_t i = 0; i <= steps; i++)
+    {
+        // clockwise from the top left corner, ending where it started
+        size_t j = i % steps;
+        double u, v;
+        
+        if(j < steps_x)
+        {
+            u = left + w * j / steps_x;
+            v = top;
+        }
+        else if(j < steps_x + steps_y)
+        {
+            u = right;
+            v = top + h * (j - steps_x) / steps_y;
+        }
+        else if(j < 2*steps_x + steps_y)
+        {
+            u = right - w * (j - steps_x - steps_y) / steps_x;
+            v = bottom;
+        }
+        else
+        {
+            u = left;
+            v = bottom - h * (j - 2*steps_x - steps_y) / steps_y;
+        }
+        
+        LatLong LL;
+        LL.long_ = u / out_period * 2*M_PI;
+        LL.lat = M_PI/2 - v / (output_height - 1.0) * M_PI;
+        
+        double sx, sy;
+        vec3_to_src(rot * latlong_to_vec3(LL), mask.width, mask.height,
+            sx, sy);
+        
+        if(i == 0)
+        {
+            min_x = max_x = sx;
+            min_y = max_y = sy;
+        }
+        else
+        {
+            while(sx - last_x > period / 2)
+                sx -= period;
+            while(last_x - sx > period / 2)
+                sx += period;
+            
+            max_step = max(max_step, fabs(sx - last_x));
+            max_step = max(max_step, fabs(sy - last_y));
+            
+            min_x = min(min_x, sx);
+            max_x = max(max_x, sx);
+            min_y = min(min_y, sy);
+            max_y = max(max_y, sy);
+        }
+        
+        last_x = sx;
+        last_y = sy;
+    }
+    
+    // an outline that does not close goes around a source pole
+    if(max_x - min_x >= period / 2)
+        return COVERAGE_MIXED;
+    
+    // between the outline's points the footprint can bulge out by about
+    // a step; then a pixel for the bilinear taps and one for rounding
+    double pad = max_step + 2;
+    
+    long cx0 = (long)floor(min_x - pad);
+    long cx1 = (long)ceil(max_x + pad);
+    double ry0 = max(floor(min_y - pad), 0.0);
+    double ry1 = min(ceil(max_y + pad), mask.height - 1.0);
+    
+    return mask.region(cx0, (size_t)ry0, cx1, (size_t)ry1);
+}
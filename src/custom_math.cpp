@@ -76,19 +76,6 @@ LL2Vec3_Table::LL2Vec3_Table(int w, int h, int s)
     }
 }
 
-Vec3 LL2Vec3_Table::lookup(int x, int sub_x, int y, int sub_y)
-{
-    int long_ = x * subpixels + sub_x;
-    int lat   = y * subpixels + sub_y;
-    
-    Vec3 result;
-    result.x = cos_long[long_] * cos_lat[lat];
-    result.y = sin_long[long_] * cos_lat[lat];
-    result.z = sin_lat[lat];
-    
-    return result;
-}
-
 Vec3 latlong_to_vec3(const LatLong& LL)
 {
     Vec3 result;
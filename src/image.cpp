@@ -1,11 +1,17 @@
 #include "image.h"
+#include "sample_image.h"
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
 using namespace std;
 
+#include <vector>
+#include <csetjmp>
+
 #include "jpeglib.h"
 #include "tiffio.h"
+#include "png.h"
+#include "zlib.h"
 
 
 bool exact_match(const RGBAF& a, const RGBAF& b)
@@ -106,7 +112,202 @@ RGBAF bilinear_get(const Image<RGBAF>& src, double x, double y)
     return bilinear(x_frac, y_frac, values);
 }
 
-ImageLoadResult load_tiff(Image<RGBAF>& into, const std::string& path)
+float half_to_float(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1F;
+    uint32_t mantissa = h & 0x3FF;
+    uint32_t bits;
+    
+    if(exponent == 0x1F)
+    {
+        // inf / nan
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    }
+    else if(exponent != 0)
+    {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    else if(mantissa == 0)
+    {
+        bits = sign;
+    }
+    else
+    {
+        // subnormal half -> normal float
+        exponent = 113;
+        while(!(mantissa & 0x400))
+        {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }
+    
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+uint16_t float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = ((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    
+    if(((bits >> 23) & 0xFF) == 0xFF)
+    {
+        // inf stays inf; nan keeps a nonzero mantissa
+        return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+    }
+    
+    if(exponent >= 0x1F)
+    {
+        return sign | 0x7C00;   // overflow to inf
+    }
+    
+    if(exponent <= 0)
+    {
+        if(exponent < -10)
+            return sign;        // underflow to zero
+        
+        // subnormal half: shift in the implicit bit, then round
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half_mantissa = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        
+        if(rest > halfway || (rest == halfway && (half_mantissa & 1)))
+            half_mantissa++;
+        
+        return sign | half_mantissa;
+    }
+    
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1FFF;
+    
+    // round to nearest even; a carry into the exponent is still correct
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    
+    return sign | half;
+}
+
+static inline double clamp01(double v)
+{
+    if(v < 0.0)
+        return 0.0;
+    if(v > 1.0)
+        return 1.0;
+    return v;
+}
+
+// converts count interleaved pixels of spp samples each from a TIFF or PNG
+// row into RGBAF. 3 sample images get an opaque alpha channel.
+static void decode_pixels(RGBAF* out, const void* in, size_t count,
+    uint32_t bps, uint32_t spp, SampleFormat format)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        double v[4] = {0.0, 0.0, 0.0, 1.0};
+        
+        for(uint32_t c = 0; c < spp && c < 4; c++)
+        {
+            size_t index = spp*i + c;
+            
+            if(format == SAMPLE_FLOAT && bps == 32)
+                v[c] = ((const float*)in)[index];
+            else if(format == SAMPLE_FLOAT)
+                v[c] = half_to_float(((const uint16_t*)in)[index]);
+            else if(bps == 16)
+                v[c] = ((const uint16_t*)in)[index] / (double)0xFFFF;
+            else
+                v[c] = ((const unsigned char*)in)[index] / (double)0xFF;
+        }
+        
+        out[i] = RGBAF(v[0], v[1], v[2], v[3]);
+    }
+}
+
+void ImageLoadParams::row_window(size_t height, size_t& first, 
+    size_t& last) const
+{
+    double top = floor(first_row_fraction * (height-1)) - ROW_MARGIN;
+    double bottom = ceil(last_row_fraction * (height-1)) + ROW_MARGIN;
+    
+    first = top > 0 ? (size_t)top : 0;
+    last = bottom < height-1 ? (size_t)bottom : height-1;
+    
+    if(last < first)
+        last = first;
+}
+
+void SampleImage::resize(size_t width, size_t height, int channels,
+    PixelFormat format)
+{
+    size_t bytes = format == PIXEL_U8 ? 1 : (format == PIXEL_F32 ? 4 : 2);
+    
+    pixels.width = width;
+    pixels.height = height;
+    pixels.channels = channels;
+    pixels.format = format;
+    pixels.pixel_stride = bytes * channels;
+    pixels.row_stride = pixels.pixel_stride * width;
+    
+    data.resize(pixels.row_stride * height);
+    
+    for(int c = 0; c < 4; c++)
+        pixels.planes[c] = c < channels ? &data[0] + bytes*c : 0;
+}
+
+PixelFormat sample_pixel_format(uint32_t bps, SampleFormat format)
+{
+    if(format == SAMPLE_FLOAT)
+        return bps == 32 ? PIXEL_F32 : PIXEL_F16;
+    
+    return bps == 16 ? PIXEL_U16 : PIXEL_U8;
+}
+
+// the loaders decode into either RGBAF pixels or the file's own samples
+struct LoadTarget
+{
+    Image<RGBAF>* image;
+    SampleImage* samples;
+    
+    explicit LoadTarget(Image<RGBAF>& into) : image(&into), samples(0) {}
+    explicit LoadTarget(SampleImage& into) : image(0), samples(&into) {}
+    
+    void resize(size_t width, size_t rows, const ImageLoadResult& layout)
+    {
+        if(image)
+            image->resize(width, rows);
+        else
+            samples->resize(width, rows, layout.spp, 
+                sample_pixel_format(layout.bps, layout.format));
+    }
+    
+    // count pixels of interleaved file samples into row y from column x
+    void put(size_t x, size_t y, const void* in, size_t count, 
+        const ImageLoadResult& layout)
+    {
+        if(image)
+        {
+            decode_pixels(&image->values[image->width*y + x], in, count,
+                layout.bps, layout.spp, layout.format);
+            return;
+        }
+        
+        const PixelBuffer& pixels = samples->pixels;
+        memcpy(pixels.sample(x, y, 0), in, count * pixels.pixel_stride);
+    }
+};
+
+static ImageLoadResult load_tiff_target(LoadTarget& into, 
+    const std::string& path, const ImageLoadParams& params)
 {
     ImageLoadResult result;
     
@@ -124,27 +325,28 @@ ImageLoadResult load_tiff(Image<RGBAF>& into, const std::string& path)
     TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bps);
     uint32 spp = 0;
     TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+    uint16 sample_format = SAMPLEFORMAT_UINT;
+    TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &sample_format);
     
     result.bps = bps;
     result.spp = spp;
+    result.format = 
+        sample_format == SAMPLEFORMAT_IEEEFP ? SAMPLE_FLOAT : SAMPLE_UINT;
     
-    double scale;
     int bytes;
     
-    if(bps == 8)
+    if(sample_format == SAMPLEFORMAT_IEEEFP && (bps == 16 || bps == 32))
     {
-        scale = 0xFF;
-        bytes = 1;
+        bytes = bps / 8;
     }
-    else if(bps == 16)
+    else if(sample_format == SAMPLEFORMAT_UINT && (bps == 8 || bps == 16))
     {
-        scale = 0xFFFF;
-        bytes = 2;
+        bytes = bps / 8;
     }
     else
     {
-        fprintf(stderr, "[ERROR] TIFF with unsupported bits per sample: %u\n",
-            bps);
+        fprintf(stderr, "[ERROR] TIFF with unsupported bits per sample: %u "
+            "(sample format %u)\n", bps, sample_format);
         
         TIFFClose(tif);
         return result;
@@ -159,64 +361,244 @@ ImageLoadResult load_tiff(Image<RGBAF>& into, const std::string& path)
         return result;
     }
     
-    into.resize(width, height);
+    uint16 planar = PLANARCONFIG_CONTIG;
+    TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+    
+    // the image is decoded in chunks that are independent in the file:
+    // tiles for tiled images and strips otherwise
+    const bool tiled = TIFFIsTiled(tif) != 0;
+    uint32 chunk_width = width;
+    uint32 chunk_height = height;
+    
+    if(tiled)
+    {
+        TIFFGetField(tif, TIFFTAG_TILEWIDTH, &chunk_width);
+        TIFFGetField(tif, TIFFTAG_TILELENGTH, &chunk_height);
+    }
+    else
+    {
+        TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &chunk_height);
+        
+        if(chunk_height > height)
+            chunk_height = height;
+    }
+    
+    TIFFClose(tif);
+    
+    size_t first_row, last_row;
+    params.row_window(height, first_row, last_row);
+    
+    result.first_row = first_row;
+    result.full_height = height;
+    
+    // only the rows of chunks that overlap the row window are read
+    const long across = (width + chunk_width - 1) / chunk_width;
+    const long first_down = first_row / chunk_height;
+    const long down = last_row / chunk_height + 1 - first_down;
+    const long chunks = across * down;
+    
+    // a separate planar image stores each channel in its own chunks
+    const uint32 planes = planar == PLANARCONFIG_SEPARATE ? spp : 1;
+    const uint32 plane_spp = planar == PLANARCONFIG_SEPARATE ? 1 : spp;
+    
+    const size_t chunk_pixels = (size_t)chunk_width * chunk_height;
+    const size_t plane_bytes = chunk_pixels * plane_spp * bytes;
+    
+    into.resize(width, last_row - first_row + 1, result);
+    
+    if(params.listener)
+        params.listener->image_sized(result);
     
-    void* buffer = malloc(width*spp*bytes);
+    bool failed = false;
     
-    for(uint32_t row = 0; row < height; row++)
+    // chunks finish out of order; rows are reported once every chunk of
+    // them and of the rows above is in
+    vector<long> chunks_done(down, 0);
+    long rows_done = 0;
+    
+    // the listener may do real work per call (the coverage mask is built
+    // there), so only the count is published under the lock; one thread
+    // at a time reports it, catching up with whatever the others publish
+    // meanwhile
+    size_t rows_published = 0;
+    size_t rows_reported = 0;
+    bool reporting = false;
+    
+    // libtiff handles aren't thread safe, so each thread opens its own
+    // and decodes whole chunks straight into the destination rows
+    #pragma omp parallel
     {
-        TIFFReadScanline(tif, buffer, row);
-        for(uint32 col = 0; col < width; col++)
+        TIFF* local = TIFFOpen(path.c_str(), "r");
+        
+        vector<unsigned char> planes_buffer(plane_bytes * planes);
+        vector<unsigned char> pixels;
+        
+        if(planes > 1)
+            pixels.resize(chunk_pixels * spp * bytes);
+        
+        if(!local)
+        {
+            #pragma omp critical
+            failed = true;
+        }
+        
+        #pragma omp for schedule(dynamic)
+        for(long chunk = 0; chunk < chunks; chunk++)
         {
-            RGBAF color;
+            if(!local)
+                continue;
             
-            if(bps == 8)
+            uint32 x0 = (chunk % across) * chunk_width;
+            uint32 y0 = (chunk / across + first_down) * chunk_height;
+            
+            bool ok = true;
+            
+            for(uint32 plane = 0; plane < planes; plane++)
             {
-                unsigned char* pixel = &((unsigned char*)buffer)[spp*col];
-
-                color.r = *(pixel + 0) / scale;
-                color.g = *(pixel + 1) / scale;
-                color.b = *(pixel + 2) / scale;
+                unsigned char* dst = &planes_buffer[plane_bytes * plane];
+                tmsize_t got;
                 
-                if(spp == 4)
-                {
-                    color.a = *(pixel + 3) / scale;
-                }
+                if(tiled)
+                    got = TIFFReadEncodedTile(local, 
+                        TIFFComputeTile(local, x0, y0, 0, plane),
+                        dst, plane_bytes);
                 else
+                    got = TIFFReadEncodedStrip(local, 
+                        TIFFComputeStrip(local, y0, plane),
+                        dst, plane_bytes);
+                
+                if(got < 0)
+                    ok = false;
+            }
+            
+            if(!ok)
+            {
+                #pragma omp critical
+                failed = true;
+                
+                continue;
+            }
+            
+            // interleave the planes so both layouts decode the same way
+            const unsigned char* data = &planes_buffer[0];
+            
+            if(planes > 1)
+            {
+                for(size_t i = 0; i < chunk_pixels; i++)
+                for(uint32 plane = 0; plane < planes; plane++)
                 {
-                    color.a = 1.0;
+                    memcpy(&pixels[(i*spp + plane) * bytes],
+                        &planes_buffer[plane_bytes*plane + i*bytes], bytes);
                 }
+                
+                data = &pixels[0];
             }
-            else
+            
+            uint32 w = x0 + chunk_width < width ? chunk_width : width - x0;
+            uint32 h = y0 + chunk_height < height ? chunk_height 
+                                                  : height - y0;
+            
+            for(uint32 row = 0; row < h; row++)
             {
-                uint16_t* pixel = &((uint16_t*)buffer)[spp*col];
-
-                color.r = *(pixel + 0) / scale;
-                color.g = *(pixel + 1) / scale;
-                color.b = *(pixel + 2) / scale;
+                size_t y = y0 + row;
+                
+                if(y < first_row || y > last_row)
+                    continue;
+                
+                into.put(x0, y - first_row, 
+                    data + (size_t)chunk_width*row*spp*bytes, w, result);
+            }
+            
+            if(!params.listener)
+                continue;
+            
+            bool reporter = false;
+            
+            #pragma omp critical(tiff_rows)
+            {
+                chunks_done[chunk / across]++;
+                
+                long ready = rows_done;
                 
-                if(spp == 4)
+                while(ready < down && chunks_done[ready] == across)
+                    ready++;
+                
+                if(ready != rows_done)
                 {
-                    color.a = *(pixel + 3) / scale;
+                    rows_done = ready;
+                    
+                    size_t end = (ready + first_down) * chunk_height;
+                    end = end < last_row + 1 ? end : last_row + 1;
+                    
+                    rows_published = end - first_row;
+                    
+                    if(!reporting)
+                        reporting = reporter = true;
                 }
-                else
+            }
+            
+            while(reporter)
+            {
+                size_t rows = 0;
+                
+                #pragma omp critical(tiff_rows)
                 {
-                    color.a = 1.0;
+                    rows = rows_published;
+                    
+                    if(rows == rows_reported)
+                        reporting = reporter = false;
+                    else
+                        rows_reported = rows;
                 }
+                
+                if(reporter)
+                    params.listener->rows_ready(rows);
             }
-            
-            into.put(col, row, color);
         }
+        
+        if(local)
+            TIFFClose(local);
     }
     
-    free(buffer);
-    TIFFClose(tif);
+    if(failed)
+    {
+        fprintf(stderr, "[ERROR] Failed to decode TIFF data: %s\n", 
+            path.c_str());
+        return result;
+    }
     
     result.ok = true;
     return result;
 }
 
-ImageLoadResult load_jpeg(Image<RGBAF>& into, const std::string& path)
+ImageLoadResult load_tiff(Image<RGBAF>& into, const std::string& path,
+    const ImageLoadParams& params)
+{
+    LoadTarget target(into);
+    return load_tiff_target(target, path, params);
+}
+
+// the IDCT can produce 1/2, 1/4 or 1/8 size output directly, which
+// cuts decode time and memory by the square of the factor
+static void set_jpeg_scale(jpeg_decompress_struct& cinfo, 
+    const ImageLoadParams& params)
+{
+    if(params.min_width == 0)
+        return;
+    
+    for(unsigned int denom = 8; denom > 1; denom /= 2)
+    {
+        if((cinfo.image_width + denom - 1) / denom >= params.min_width)
+        {
+            cinfo.scale_num = 1;
+            cinfo.scale_denom = denom;
+            break;
+        }
+    }
+}
+
+static ImageLoadResult load_jpeg_target(LoadTarget& into, 
+    const std::string& path, const ImageLoadParams& params)
 {
     ImageLoadResult result;     // ok = false by default
     
@@ -248,19 +630,46 @@ ImageLoadResult load_jpeg(Image<RGBAF>& into, const std::string& path)
     }
     
     cinfo.out_color_space = JCS_RGB;
+    set_jpeg_scale(cinfo, params);
+    
+    jpeg_start_decompress(&cinfo);
     
-    unsigned char* data = (unsigned char*)malloc(3*cinfo.image_width);
+    result.scale_denom = cinfo.scale_denom;
     
-    into.resize(cinfo.image_width, cinfo.image_height);
+    unsigned char* data = (unsigned char*)malloc(3*cinfo.output_width);
     
-    jpeg_start_decompress(&cinfo);
+    size_t first_row, last_row;
+    params.row_window(cinfo.output_height, first_row, last_row);
     
-    size_t y = 0;
-    while(cinfo.output_scanline < cinfo.image_height)
+    result.first_row = first_row;
+    result.full_height = cinfo.output_height;
+    
+    into.resize(cinfo.output_width, last_row - first_row + 1, result);
+    
+    if(params.listener)
+        params.listener->image_sized(result);
+    
+#ifdef LIBJPEG_TURBO_VERSION
+    // rows above the window still have to be entropy decoded, but not
+    // upsampled or color converted
+    if(first_row > 0)
+        jpeg_skip_scanlines(&cinfo, first_row);
+#endif
+    
+    while(cinfo.output_scanline <= last_row)
     {
-        memset(data, '\0', 3*cinfo.image_width);
+        size_t y = cinfo.output_scanline;
+        
+        memset(data, '\0', 3*cinfo.output_width);
         jpeg_read_scanlines(&cinfo, &data, 1);
-        for(size_t i = 0; i < cinfo.image_width; i++)
+        
+        if(y < first_row)
+            continue;
+        
+        if(into.samples)
+            into.put(0, y - first_row, data, cinfo.output_width, result);
+        
+        for(size_t i = 0; into.image && i < cinfo.output_width; i++)
         {
             unsigned char* p = &data[3*i];
             
@@ -270,12 +679,19 @@ ImageLoadResult load_jpeg(Image<RGBAF>& into, const std::string& path)
             pixel.b = *(p+2) / (float)0xFF;
             pixel.a = 1.0;
             
-            into.put(i, y, pixel);
+            into.image->put(i, y - first_row, pixel);
         }
-        y++;
+        
+        if(params.listener)
+            params.listener->rows_ready(y - first_row + 1);
     }
     
-    jpeg_finish_decompress(&cinfo);
+    // rows below the window are never decoded
+    if(cinfo.output_scanline < cinfo.output_height)
+        jpeg_abort_decompress(&cinfo);
+    else
+        jpeg_finish_decompress(&cinfo);
+    
     jpeg_destroy_decompress(&cinfo);
     fclose(fp);
     
@@ -285,27 +701,91 @@ ImageLoadResult load_jpeg(Image<RGBAF>& into, const std::string& path)
     return result;
 }
 
-void save_jpeg(const Image<RGBAF>& from, const std::string& path, 
-    ImageSaveParams params)
+ImageLoadResult load_jpeg(Image<RGBAF>& into, const std::string& path,
+    const ImageLoadParams& params)
+{
+    LoadTarget target(into);
+    return load_jpeg_target(target, path, params);
+}
+
+struct JpegRowWriter : public RowWriter
 {
     jpeg_compress_struct cinfo;
     jpeg_error_mgr error;
+    FILE* fp;
+    string path;
+    vector<unsigned char> row;
     
-    cinfo.err = jpeg_std_error(&error);
+    ~JpegRowWriter()
+    {
+        if(fp)
+            finish();
+    }
     
-    jpeg_create_compress(&cinfo);
+    // completes the file; false (after printing why) if it couldn't be
+    // written out, e.g. on a full disk
+    bool finish()
+    {
+        jpeg_finish_compress(&cinfo);
+        jpeg_destroy_compress(&cinfo);
+        
+        bool ok = !ferror(fp);
+        
+        if(fclose(fp) != 0)
+            ok = false;
+        
+        fp = 0;
+        
+        if(!ok)
+            fprintf(stderr, "[ERROR] Failed to write %s\n", path.c_str());
+        
+        return ok;
+    }
     
+    bool write_rows(const Image<RGBAF>& band)
+    {
+        unsigned char* data = &row[0];
+        
+        for(size_t y = 0; y < band.height; y++)
+        {
+            for(size_t x = 0; x < band.width; x++)
+            {
+                const RGBAF& p = band.get(x,y);
+                data[3*x+0] = clamp01(p.r) * 255;
+                data[3*x+1] = clamp01(p.g) * 255;
+                data[3*x+2] = clamp01(p.b) * 255;
+            }
+            
+            jpeg_write_scanlines(&cinfo, &data, 1);
+        }
+        
+        return true;
+    }
+};
+
+static JpegRowWriter* open_jpeg(const std::string& path, size_t width,
+    size_t height, ImageSaveParams params)
+{
     FILE* fp = fopen(path.c_str(), "wb");
     if(!fp)
     {
         perror("Failed to open file for writing");
-        return;
+        return 0;
     }
     
+    JpegRowWriter* writer = new JpegRowWriter();
+    writer->fp = fp;
+    writer->path = path;
+    writer->row.resize(width*3);
+    
+    jpeg_compress_struct& cinfo = writer->cinfo;
+    cinfo.err = jpeg_std_error(&writer->error);
+    
+    jpeg_create_compress(&cinfo);
     jpeg_stdio_dest(&cinfo, fp);
     
-    cinfo.image_width  = from.width;
-    cinfo.image_height = from.height;
+    cinfo.image_width  = width;
+    cinfo.image_height = height;
     cinfo.input_components = 3;
     cinfo.in_color_space = JCS_RGB;
     
@@ -314,131 +794,573 @@ void save_jpeg(const Image<RGBAF>& from, const std::string& path,
     
     jpeg_start_compress(&cinfo, TRUE);
     
-    unsigned char* data = (unsigned char*)malloc(from.width*3);
-    size_t y = 0;
-    while(cinfo.next_scanline < cinfo.image_height)
-    {
-        for(size_t x = 0; x < from.width; x++)
-        {
-            const RGBAF& p = from.get(x,y);
-            data[3*x+0] = p.r * 255;
-            data[3*x+1] = p.g * 255;
-            data[3*x+2] = p.b * 255;
-        }
-        
-        jpeg_write_scanlines(&cinfo, &data, 1);
-        y++;
-    }
+    return writer;
+}
 
-    free(data);
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-    fclose(fp);
+RowWriter* open_jpeg_writer(const std::string& path, size_t width,
+    size_t height, ImageSaveParams params)
+{
+    return open_jpeg(path, width, height, params);
 }
 
-void save_tiff(const Image<RGBAF>& from, const std::string& path, 
+bool write_jpeg(const Image<RGBAF>& from, const std::string& path, 
     ImageSaveParams params)
 {
-    unsigned char* row_bytes = NULL;
-    uint16_t* row_shorts = NULL;
-    void* row = NULL;
+    JpegRowWriter* writer = open_jpeg(path, from.width, from.height, 
+        params);
+    
+    if(!writer)
+        return false;
+    
+    writer->write_rows(from);
+    
+    bool ok = writer->finish();
+    delete writer;
+    
+    return ok;
+}
 
-    if(params.spp !=3 && params.spp != 4)
+void save_jpeg(const Image<RGBAF>& from, const std::string& path, 
+    ImageSaveParams params)
+{
+    write_jpeg(from, path, params);
+}
+
+struct TiffRowWriter : public RowWriter
+{
+    TIFF* tif;
+    ImageSaveParams params;
+    uint32_t next_row;
+    vector<unsigned char> row;
+    
+    ~TiffRowWriter()
     {
-        fprintf(stderr, "[ERROR] Unsupported output TIFF SPP: %d\n",
-            params.spp);
-        
-        return;
+        TIFFClose(tif);
     }
-
-    if(params.bps == 8)
+    
+    bool write_rows(const Image<RGBAF>& band)
     {
-        row_bytes = (unsigned char*)malloc(from.width * params.spp);
-        memset(row_bytes, '\0', from.width * params.spp);
+        bool floating = params.format == SAMPLE_FLOAT;
         
-        row = row_bytes;
+        unsigned char* row_bytes = &row[0];
+        uint16_t* row_shorts = (uint16_t*)&row[0];
+        float* row_floats = (float*)&row[0];
+        
+        for(size_t y = 0; y < band.height; y++)
+        {
+            for(size_t x = 0; x < band.width; x++)
+            {
+                const RGBAF& p = band.values[band.width*y + x];
+                double v[4] = {p.r, p.g, p.b, p.a};
+                
+                for(uint32_t c = 0; c < params.spp; c++)
+                {
+                    size_t index = params.spp*x + c;
+                    
+                    // float samples keep their full (HDR) range
+                    if(floating && params.bps == 32)
+                        row_floats[index] = v[c];
+                    else if(floating)
+                        row_shorts[index] = float_to_half(v[c]);
+                    else if(params.bps == 16)
+                        row_shorts[index] = 0xFFFF * clamp01(v[c]);
+                    else
+                        row_bytes[index] = 0xFF * clamp01(v[c]);
+                }
+            }
+            
+            if(TIFFWriteScanline(tif, &row[0], next_row++, 0) < 0)
+                return false;
+        }
+        
+        return true;
     }
-    else if(params.bps == 16)
+};
+
+RowWriter* open_tiff_writer(const std::string& path, size_t width,
+    size_t height, ImageSaveParams params)
+{
+    if(params.spp !=3 && params.spp != 4)
     {
-        row_shorts = (uint16_t*)malloc(from.width * params.spp * 2);
-        memset(row_shorts, '\0', from.width * params.spp * 2);
+        fprintf(stderr, "[ERROR] Unsupported output TIFF SPP: %d\n",
+            params.spp);
         
-        row = row_shorts;
+        return 0;
     }
-    else
+    
+    bool floating = params.format == SAMPLE_FLOAT;
+
+    if(floating ? (params.bps != 16 && params.bps != 32)
+                : (params.bps != 8  && params.bps != 16))
     {
         fprintf(stderr, "[ERROR] Unsupported output TIFF BPS: %d\n", 
             params.bps);
-        return;
+        return 0;
     }
     
-    
     TIFF* tif = TIFFOpen(path.c_str(), "w");
     
     if(!tif)
     {
         perror("save_tiff");
-        return;
+        return 0;
     }
     
-    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, from.width);
-    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, from.height);
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
     TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, params.spp);
     TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, params.bps);
+    TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, 
+        floating ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
     TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
     TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);    
     TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
     TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif,0));
     
+    if(params.description.size() != 0)
+        TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, params.description.c_str());
+    
     if(params.spp == 4)
     {
         uint16 extra_list[1] = {EXTRASAMPLE_ASSOCALPHA};
         TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, 1, &extra_list);
     }
     
-    for(size_t y = 0; y < from.height; y++)
+    TiffRowWriter* writer = new TiffRowWriter();
+    writer->tif = tif;
+    writer->params = params;
+    writer->next_row = 0;
+    writer->row.resize(width * params.spp * (params.bps / 8), 0);
+    
+    return writer;
+}
+
+void save_tiff(const Image<RGBAF>& from, const std::string& path, 
+    ImageSaveParams params)
+{
+    RowWriter* writer = open_tiff_writer(path, from.width, from.height, 
+        params);
+    
+    if(!writer)
+        return;
+    
+    writer->write_rows(from);
+    delete writer;
+}
+
+// normalizes every PNG to 8 or 16 bit RGB(A)
+static void png_set_rgb_transforms(png_structp png, png_infop info)
+{
+    int color_type = png_get_color_type(png, info);
+    int bit_depth = png_get_bit_depth(png, info);
+    
+    if(color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(png);
+    if(color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+        png_set_expand_gray_1_2_4_to_8(png);
+    if(png_get_valid(png, info, PNG_INFO_tRNS))
+        png_set_tRNS_to_alpha(png);
+    if(color_type == PNG_COLOR_TYPE_GRAY || 
+       color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png);
+    if(bit_depth == 16)
+        png_set_swap(png);  // PNG is big endian; we read native uint16
+}
+
+static ImageLoadResult load_png_target(LoadTarget& into, 
+    const std::string& path, const ImageLoadParams& params)
+{
+    ImageLoadResult result;     // ok = false by default
+    
+    FILE* fp = fopen(path.c_str(), "rb");
+    if(!fp)
+    {
+        fprintf(stderr, "[ERROR] Failed to open: %s\n", path.c_str());
+        return result;
+    }
+    
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+    png_infop info = png ? png_create_info_struct(png) : 0;
+    
+    if(!info)
     {
-        for(size_t x = 0; x < from.width; x++)
+        fprintf(stderr, "[ERROR] Failed to set up PNG decoder\n");
+        png_destroy_read_struct(&png, 0, 0);
+        fclose(fp);
+        return result;
+    }
+    
+    // touched after setjmp, so it must be volatile to survive a longjmp
+    unsigned char* volatile data = NULL;
+    
+    if(setjmp(png_jmpbuf(png)))
+    {
+        fprintf(stderr, "[ERROR] Failed to decode PNG: %s\n", path.c_str());
+        png_destroy_read_struct(&png, &info, 0);
+        free(data);
+        fclose(fp);
+        return result;
+    }
+    
+    png_init_io(png, fp);
+    png_read_info(png, info);
+    png_set_rgb_transforms(png, info);
+    
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+    
+    png_uint_32 width = png_get_image_width(png, info);
+    png_uint_32 height = png_get_image_height(png, info);
+    
+    result.bps = png_get_bit_depth(png, info);
+    result.spp = png_get_channels(png, info);
+    result.format = SAMPLE_UINT;
+    
+    size_t row_bytes = png_get_rowbytes(png, info);
+    
+    size_t first_row, last_row;
+    params.row_window(height, first_row, last_row);
+    
+    result.first_row = first_row;
+    result.full_height = height;
+    
+    into.resize(width, last_row - first_row + 1, result);
+    
+    if(params.listener)
+        params.listener->image_sized(result);
+    
+    if(passes == 1)
+    {
+        // rows are decoded one at a time straight into the destination,
+        // stopping after the last row that is kept
+        data = (unsigned char*)malloc(row_bytes);
+        
+        for(png_uint_32 y = 0; y <= last_row; y++)
         {
-            if(params.bps == 8)
+            png_read_row(png, data, NULL);
+            
+            if(y < first_row)
+                continue;
+            
+            into.put(0, y - first_row, data, width, result);
+            
+            if(params.listener)
+                params.listener->rows_ready(y - first_row + 1);
+        }
+    }
+    else
+    {
+        // interlaced images need the whole image before any row is final
+        data = (unsigned char*)malloc(row_bytes * height);
+        vector<png_bytep> rows(height);
+        
+        for(png_uint_32 y = 0; y < height; y++)
+            rows[y] = data + row_bytes * y;
+        
+        png_read_image(png, &rows[0]);
+        
+        for(png_uint_32 y = first_row; y <= last_row; y++)
+        {
+            into.put(0, y - first_row, rows[y], width, result);
+        }
+        
+        if(params.listener)
+            params.listener->rows_ready(last_row - first_row + 1);
+    }
+    
+    if(last_row + 1 == height)
+        png_read_end(png, NULL);
+    
+    png_destroy_read_struct(&png, &info, 0);
+    free(data);
+    fclose(fp);
+    
+    result.ok = true;
+    return result;
+}
+
+ImageLoadResult load_png(Image<RGBAF>& into, const std::string& path,
+    const ImageLoadParams& params)
+{
+    LoadTarget target(into);
+    return load_png_target(target, path, params);
+}
+
+// writes one PNG scanline (big endian samples, no filter byte)
+static void png_raw_row(unsigned char* out, const Image<RGBAF>& from, 
+    size_t y, uint32_t bps, uint32_t spp)
+{
+    const RGBAF* row = &from.values[from.width*y];
+    
+    for(size_t x = 0; x < from.width; x++)
+    {
+        double v[4] = {row[x].r, row[x].g, row[x].b, row[x].a};
+        
+        for(uint32_t c = 0; c < spp; c++)
+        {
+            if(bps == 16)
             {
-                row_bytes[params.spp*x+0] = 0xFF * from.get(x,y).r;
-                row_bytes[params.spp*x+1] = 0xFF * from.get(x,y).g;
-                row_bytes[params.spp*x+2] = 0xFF * from.get(x,y).b;
-                
-                if(params.spp == 4)
-                {
-                    row_bytes[params.spp*x+3] = 0xFF * from.get(x,y).a;
-                }
+                uint16_t s = 0xFFFF * clamp01(v[c]);
+                *out++ = s >> 8;
+                *out++ = s & 0xFF;
             }
-            else if(params.bps == 16)
+            else
             {
-                row_shorts[params.spp*x+0] = 0xFFFF * from.get(x,y).r;
-                row_shorts[params.spp*x+1] = 0xFFFF * from.get(x,y).g;
-                row_shorts[params.spp*x+2] = 0xFFFF * from.get(x,y).b;
-                
-                if(params.spp == 4)
-                {
-                    row_shorts[params.spp*x+3] = 0xFFFF * from.get(x,y).a;
-                }
+                *out++ = 0xFF * clamp01(v[c]);
             }
-            else
+        }
+    }
+}
+
+static inline unsigned char paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    
+    if(pa <= pb && pa <= pc)
+        return a;
+    if(pb <= pc)
+        return b;
+    return c;
+}
+
+// appends the filtered rows y0..y1 (filter byte + data) to out, picking
+// the filter per row with the usual minimum sum of absolute values rule
+static void png_filter_rows(vector<unsigned char>& out, 
+    const Image<RGBAF>& from, size_t y0, size_t y1, 
+    uint32_t bps, uint32_t spp)
+{
+    const size_t bpp = spp * bps / 8;
+    const size_t row_bytes = from.width * bpp;
+    
+    vector<unsigned char> prev(row_bytes, 0);
+    vector<unsigned char> cur(row_bytes);
+    vector<unsigned char> candidate[5];
+    
+    for(int f = 0; f < 5; f++)
+        candidate[f].resize(row_bytes);
+    
+    if(y0 > 0)
+        png_raw_row(&prev[0], from, y0-1, bps, spp);
+    
+    for(size_t y = y0; y < y1; y++)
+    {
+        png_raw_row(&cur[0], from, y, bps, spp);
+        
+        unsigned long cost[5] = {0, 0, 0, 0, 0};
+        
+        for(size_t i = 0; i < row_bytes; i++)
+        {
+            int a = i >= bpp ? cur[i-bpp] : 0;
+            int b = prev[i];
+            int c = i >= bpp ? prev[i-bpp] : 0;
+            int x = cur[i];
+            
+            unsigned char filtered[5] = {
+                (unsigned char)x,
+                (unsigned char)(x - a),
+                (unsigned char)(x - b),
+                (unsigned char)(x - ((a + b) >> 1)),
+                (unsigned char)(x - paeth(a, b, c))
+            };
+            
+            for(int f = 0; f < 5; f++)
             {
-                fprintf(stderr, "[ERROR] save_tiff invalid state\n");
-                TIFFClose(tif);
-                return;
+                candidate[f][i] = filtered[f];
+                cost[f] += filtered[f] < 128 ? filtered[f] : 256-filtered[f];
             }
         }
         
-        TIFFWriteScanline(tif, row, y, 0);
+        int best = 0;
+        for(int f = 1; f < 5; f++)
+        {
+            if(cost[f] < cost[best])
+                best = f;
+        }
+        
+        out.push_back(best);
+        out.insert(out.end(), candidate[best].begin(), candidate[best].end());
+        
+        cur.swap(prev);
     }
+}
+
+static void png_write_chunk(FILE* fp, const char* type, 
+    const unsigned char* data, size_t size)
+{
+    unsigned char header[8] = {
+        (unsigned char)(size >> 24), (unsigned char)(size >> 16),
+        (unsigned char)(size >> 8),  (unsigned char)size,
+        (unsigned char)type[0], (unsigned char)type[1],
+        (unsigned char)type[2], (unsigned char)type[3]
+    };
     
-    free(row);
-    row = NULL;
-    row_bytes = NULL;
-    row_shorts = NULL;
+    uLong crc = crc32(0, header + 4, 4);
+    if(size)
+        crc = crc32(crc, data, size);
     
-    TIFFClose(tif);
+    unsigned char trailer[4] = {
+        (unsigned char)(crc >> 24), (unsigned char)(crc >> 16),
+        (unsigned char)(crc >> 8),  (unsigned char)crc
+    };
+    
+    fwrite(header, 1, 8, fp);
+    if(size)
+        fwrite(data, 1, size, fp);
+    fwrite(trailer, 1, 4, fp);
+}
+
+// PNG output is compressed in independent bands of rows on all threads
+// (the same trick pigz uses): each band is a raw deflate stream primed
+// with the previous 32K of data and ended with a sync flush, so the
+// concatenation is one valid zlib stream with a combined adler32.
+void save_png(const Image<RGBAF>& from, const std::string& path, 
+    ImageSaveParams params)
+{
+    if((params.spp != 3 && params.spp != 4) || 
+       (params.bps != 8 && params.bps != 16))
+    {
+        fprintf(stderr, "[ERROR] Unsupported output PNG format: %d bps, "
+            "%d spp\n", params.bps, params.spp);
+        return;
+    }
+    
+    int level = params.png_level;
+    if(level < 0 || level > 9)
+        level = Z_DEFAULT_COMPRESSION;
+    
+    const size_t row_bytes = 1 + from.width * params.spp * params.bps / 8;
+    const size_t WINDOW = 32768;
+    
+    // bands of at least 256K of input keep the per band overhead small
+    size_t band_rows = (256*1024 + row_bytes - 1) / row_bytes;
+    if(band_rows < 1)
+        band_rows = 1;
+    
+    const size_t bands = (from.height + band_rows - 1) / band_rows;
+    
+    vector< vector<unsigned char> > compressed(bands);
+    vector<uLong> adler(bands);
+    vector<size_t> raw_size(bands);
+    bool failed = false;
+    
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(long band = 0; band < (long)bands; band++)
+    {
+        size_t y0 = band * band_rows;
+        size_t y1 = y0 + band_rows < from.height ? y0 + band_rows 
+                                                 : from.height;
+        
+        vector<unsigned char> raw;
+        raw.reserve((y1 - y0) * row_bytes);
+        png_filter_rows(raw, from, y0, y1, params.bps, params.spp);
+        
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        
+        if(deflateInit2(&z, level, Z_DEFLATED, -15, 8, 
+            Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            #pragma omp critical
+            failed = true;
+            
+            continue;
+        }
+        
+        if(band > 0)
+        {
+            // prime with the tail of the previous band's filtered data
+            size_t dict_rows = (WINDOW + row_bytes - 1) / row_bytes;
+            size_t d0 = y0 > dict_rows ? y0 - dict_rows : 0;
+            
+            vector<unsigned char> dict;
+            png_filter_rows(dict, from, d0, y0, params.bps, params.spp);
+            
+            size_t n = dict.size() < WINDOW ? dict.size() : WINDOW;
+            deflateSetDictionary(&z, &dict[dict.size() - n], n);
+        }
+        
+        vector<unsigned char>& out = compressed[band];
+        out.resize(deflateBound(&z, raw.size()) + 16);
+        
+        z.next_in = &raw[0];
+        z.avail_in = raw.size();
+        z.next_out = &out[0];
+        z.avail_out = out.size();
+        
+        int flush = band == (long)bands-1 ? Z_FINISH : Z_SYNC_FLUSH;
+        int status = deflate(&z, flush);
+        
+        if((flush == Z_FINISH && status != Z_STREAM_END) ||
+           (flush != Z_FINISH && status != Z_OK) || z.avail_in != 0)
+        {
+            #pragma omp critical
+            failed = true;
+        }
+        
+        out.resize(z.total_out);
+        deflateEnd(&z);
+        
+        adler[band] = adler32(adler32(0, 0, 0), &raw[0], raw.size());
+        raw_size[band] = raw.size();
+    }
+    
+    if(failed)
+    {
+        fprintf(stderr, "[ERROR] PNG compression failed\n");
+        return;
+    }
+    
+    FILE* fp = fopen(path.c_str(), "wb");
+    if(!fp)
+    {
+        perror("save_png");
+        return;
+    }
+    
+    fwrite("\x89PNG\r\n\x1A\n", 1, 8, fp);
+    
+    unsigned char ihdr[13] = {
+        (unsigned char)(from.width >> 24), (unsigned char)(from.width >> 16),
+        (unsigned char)(from.width >> 8),  (unsigned char)from.width,
+        (unsigned char)(from.height >> 24), (unsigned char)(from.height >> 16),
+        (unsigned char)(from.height >> 8),  (unsigned char)from.height,
+        (unsigned char)params.bps,
+        (unsigned char)(params.spp == 4 ? 6 : 2),   // RGBA : RGB
+        0, 0, 0     // deflate, adaptive filtering, no interlace
+    };
+    png_write_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+    
+    // zlib header: 32K window, no preset dictionary, level hint
+    int level_hint = level == 0 ? 0 : (level < 6 ? 1 : (level == 6 || 
+        level == Z_DEFAULT_COMPRESSION ? 2 : 3));
+    unsigned char zlib_header[2] = {0x78, (unsigned char)(level_hint << 6)};
+    zlib_header[1] += 31 - (zlib_header[0] * 256 + zlib_header[1]) % 31;
+    png_write_chunk(fp, "IDAT", zlib_header, 2);
+    
+    uLong check = adler[0];
+    for(size_t band = 0; band < bands; band++)
+    {
+        if(band > 0)
+            check = adler32_combine(check, adler[band], raw_size[band]);
+        
+        if(!compressed[band].empty())
+        {
+            png_write_chunk(fp, "IDAT", &compressed[band][0], 
+                compressed[band].size());
+        }
+    }
+    
+    unsigned char zlib_trailer[4] = {
+        (unsigned char)(check >> 24), (unsigned char)(check >> 16),
+        (unsigned char)(check >> 8),  (unsigned char)check
+    };
+    png_write_chunk(fp, "IDAT", zlib_trailer, 4);
+    png_write_chunk(fp, "IEND", 0, 0);
+    
+    fclose(fp);
 }
 
 void convert_image(Image<RGB8>& dst, const Image<RGBAF>& src)
@@ -449,17 +1371,64 @@ void convert_image(Image<RGB8>& dst, const Image<RGBAF>& src)
     for(size_t x = 0; x < src.width; x++)
     {
         RGB8 pixel;
-        pixel.r = 0xFF * src.get(x,y).r;
-        pixel.g = 0xFF * src.get(x,y).g;
-        pixel.b = 0xFF * src.get(x,y).b;
+        pixel.r = 0xFF * clamp01(src.get(x,y).r);
+        pixel.g = 0xFF * clamp01(src.get(x,y).g);
+        pixel.b = 0xFF * clamp01(src.get(x,y).b);
         dst.put(x,y,pixel);
     }
 }
 
-ImageLoadResult load(Image<RGBAF>& into, const std::string& path)
+void downscale(Image<RGBAF>& dst, const Image<RGBAF>& src, 
+    size_t width, size_t height)
 {
-    ImageLoadResult bad_result;     // ok = false by default
+    dst.resize(width, height);
+    
+    double scale_x = (double)src.width / width;
+    double scale_y = (double)src.height / height;
     
+    // area average: every source pixel contributes by how much of it is
+    // covered by the destination pixel's footprint
+    #pragma omp parallel for
+    for(size_t y = 0; y < height; y++)
+    for(size_t x = 0; x < width; x++)
+    {
+        double fx0 = x * scale_x, fx1 = (x+1) * scale_x;
+        double fy0 = y * scale_y, fy1 = (y+1) * scale_y;
+        
+        RGBAF sum;
+        double weight = 0.0;
+        
+        for(size_t sy = (size_t)fy0; sy < src.height && sy < fy1; sy++)
+        {
+            double wy = fmin(fy1, sy+1.0) - fmax(fy0, (double)sy);
+            
+            for(size_t sx = (size_t)fx0; sx < src.width && sx < fx1; sx++)
+            {
+                double wx = fmin(fx1, sx+1.0) - fmax(fx0, (double)sx);
+                
+                sum += (wx*wy) * src.values[src.width*sy + sx];
+                weight += wx*wy;
+            }
+        }
+        
+        if(weight > 0)
+            sum *= 1.0 / weight;
+        
+        dst.values[width*y + x] = sum;
+    }
+}
+
+enum ImageFileType
+{
+    FILE_UNKNOWN,
+    FILE_PNG,
+    FILE_JPEG,
+    FILE_TIFF
+};
+
+// tells the input formats apart by their first bytes
+static ImageFileType image_file_type(const std::string& path)
+{
     char buffer[16];
     memset(buffer, '\0', sizeof(buffer));
     
@@ -468,7 +1437,7 @@ ImageLoadResult load(Image<RGBAF>& into, const std::string& path)
     if(!fp)
     {
         fprintf(stderr, "[ERROR] Failed to open file: %s\n", path.c_str());
-        return bad_result;
+        return FILE_UNKNOWN;
     }
     
     size_t read_size = fread(buffer, 1, 16, fp);
@@ -477,31 +1446,177 @@ ImageLoadResult load(Image<RGBAF>& into, const std::string& path)
     if(read_size != 16)
     {
         fprintf(stderr, "[ERROR] Failed to read from file: %s\n", path.c_str());
-        return bad_result;
+        return FILE_UNKNOWN;
     }
     
     // PNG
     if(memcmp(buffer, "\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 8) == 0)
     {
-        fprintf(stderr, "[ERROR] PNG input type is not supported yet\n");
-        return bad_result;
+        return FILE_PNG;
     }
     
     // JPG
     if(memcmp(buffer, "\xFF\xD8\xFF\xE0", 4) == 0 ||
        memcmp(buffer, "\xFF\xD8\xFF\xE1", 4) == 0)
     {
-        return load_jpeg(into, path);
+        return FILE_JPEG;
     }
     
     // TIFF
     if( memcmp(buffer, "\x49\x49\x2A\x00", 4) == 0 || 
         memcmp(buffer, "\x4D\x4D\x00\x2A", 4) == 0)
     {
-        return load_tiff(into, path);
+        return FILE_TIFF;
     }
     
     fprintf(stderr, "[ERROR] Did not recognize input file format.\n");
-    return bad_result;
+    return FILE_UNKNOWN;
+}
+
+ImageLoadResult load(Image<RGBAF>& into, const std::string& path,
+    const ImageLoadParams& params)
+{
+    switch(image_file_type(path))
+    {
+        case FILE_PNG:
+            return load_png(into, path, params);
+        
+        case FILE_JPEG:
+            return load_jpeg(into, path, params);
+        
+        case FILE_TIFF:
+            return load_tiff(into, path, params);
+        
+        default:
+            return ImageLoadResult();
+    }
+}
+
+ImageLoadResult load_samples(SampleImage& into, const std::string& path,
+    const ImageLoadParams& params)
+{
+    LoadTarget target(into);
+    
+    switch(image_file_type(path))
+    {
+        case FILE_PNG:
+            return load_png_target(target, path, params);
+        
+        case FILE_JPEG:
+            return load_jpeg_target(target, path, params);
+        
+        case FILE_TIFF:
+            return load_tiff_target(target, path, params);
+        
+        default:
+            return ImageLoadResult();
+    }
+}
+
+bool read_image_size(const std::string& path, const ImageLoadParams& params,
+    size_t& width, size_t& height)
+{
+    ImageLoadResult layout;
+    return read_image_info(path, params, width, height, layout);
+}
+
+bool read_image_info(const std::string& path, const ImageLoadParams& params,
+    size_t& width, size_t& height, ImageLoadResult& layout)
+{
+    ImageFileType type = image_file_type(path);
+    
+    layout = ImageLoadResult();
+    
+    if(type == FILE_TIFF)
+    {
+        TIFF* tif = TIFFOpen(path.c_str(), "r");
+        
+        if(!tif)
+            return false;
+        
+        uint32 w = 0, h = 0;
+        uint16 bps = 0, spp = 0, format = SAMPLEFORMAT_UINT;
+        TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+        TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+        TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bps);
+        TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+        TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &format);
+        TIFFClose(tif);
+        
+        width = w;
+        height = h;
+        layout.bps = bps;
+        layout.spp = spp;
+        layout.format = 
+            format == SAMPLEFORMAT_IEEEFP ? SAMPLE_FLOAT : SAMPLE_UINT;
+        layout.full_height = h;
+        return true;
+    }
+    
+    FILE* fp = type != FILE_UNKNOWN ? fopen(path.c_str(), "rb") : 0;
+    
+    if(!fp)
+        return false;
+    
+    bool ok = false;
+    
+    if(type == FILE_JPEG)
+    {
+        jpeg_decompress_struct cinfo;
+        jpeg_error_mgr jerr;
+        
+        memset(&cinfo, 0, sizeof(cinfo));
+        cinfo.err = jpeg_std_error(&jerr);
+        
+        jpeg_create_decompress(&cinfo);
+        jpeg_stdio_src(&cinfo, fp);
+        
+        if(jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK)
+        {
+            // the size after any reduced size decode load_jpeg would do
+            cinfo.out_color_space = JCS_RGB;
+            set_jpeg_scale(cinfo, params);
+            jpeg_calc_output_dimensions(&cinfo);
+            
+            width = cinfo.output_width;
+            height = cinfo.output_height;
+            layout.scale_denom = cinfo.scale_denom;
+            ok = true;
+        }
+        
+        jpeg_destroy_decompress(&cinfo);
+    }
+    else
+    {
+        png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, 
+            0, 0, 0);
+        png_infop info = png ? png_create_info_struct(png) : 0;
+        
+        if(info && !setjmp(png_jmpbuf(png)))
+        {
+            png_init_io(png, fp);
+            png_read_info(png, info);
+            png_set_rgb_transforms(png, info);
+            png_read_update_info(png, info);
+            
+            width = png_get_image_width(png, info);
+            height = png_get_image_height(png, info);
+            layout.bps = png_get_bit_depth(png, info);
+            layout.spp = png_get_channels(png, info);
+            ok = true;
+        }
+        
+        png_destroy_read_struct(&png, info ? &info : 0, 0);
+    }
+    
+    fclose(fp);
+    
+    if(!ok)
+        fprintf(stderr, "[ERROR] Failed to read image size: %s\n", 
+            path.c_str());
+    else
+        layout.full_height = height;
+    
+    return ok;
 }
 
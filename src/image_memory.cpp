@@ -0,0 +1,96 @@
+#include "image_memory.h"
+
+#include <cstdlib>
+#include <sys/mman.h>
+
+static bool use_huge_pages = false;
+
+static const size_t CACHE_LINE = 64;
+static const size_t HUGE_PAGE = 2 << 20;
+static const size_t PAGE = 4096;
+
+// buffers this big are mapped on their own, so freeing one gives it back
+// to the system at once. From the heap, glibc keeps freed buffers below
+// its (self raising) mmap threshold, and a run that allocates and frees
+// a band at a time would grow by a band each time.
+static const size_t MAP_THRESHOLD = 1 << 20;
+
+static size_t mapped_size(size_t bytes)
+{
+    return (bytes + PAGE - 1) / PAGE * PAGE;
+}
+
+void set_huge_pages(bool enable)
+{
+    use_huge_pages = enable;
+}
+
+bool huge_pages()
+{
+    return use_huge_pages;
+}
+
+void* image_alloc(size_t bytes)
+{
+    if(bytes == 0)
+        bytes = 1;
+    
+    // only buffers of at least one huge page are worth aligning to one
+    bool huge = use_huge_pages && bytes >= HUGE_PAGE;
+    
+    void* p = 0;
+    
+    if(bytes >= MAP_THRESHOLD)
+    {
+        // over-map by a huge page and trim to a huge page boundary
+        size_t size = mapped_size(bytes);
+        size_t slack = huge ? HUGE_PAGE : 0;
+        
+        void* map = mmap(0, size + slack, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        
+        if(map == MAP_FAILED)
+            return 0;
+        
+        char* start = (char*)map;
+        char* aligned = start;
+        
+        if(huge)
+        {
+            aligned = (char*)(((size_t)start + HUGE_PAGE - 1) & ~(HUGE_PAGE-1));
+            
+            if(aligned != start)
+                munmap(start, aligned - start);
+            
+            munmap(aligned + size, start + slack - aligned);
+        }
+        
+        p = aligned;
+    }
+    else if(posix_memalign(&p, huge ? HUGE_PAGE : CACHE_LINE, bytes) != 0)
+    {
+        return 0;
+    }
+
+#ifdef MADV_HUGEPAGE
+    // the kernel may still fall back to small pages; that is not an error
+    if(huge)
+        madvise(p, bytes - bytes % HUGE_PAGE, MADV_HUGEPAGE);
+#endif
+    
+    return p;
+}
+
+void image_free(void* p, size_t bytes)
+{
+    if(!p)
+        return;
+    
+    if(bytes == 0)
+        bytes = 1;
+    
+    if(bytes >= MAP_THRESHOLD)
+        munmap(p, mapped_size(bytes));
+    else
+        free(p);
+}
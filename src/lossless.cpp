@@ -0,0 +1,250 @@
+#include "lossless.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+#include "jpeglib.h"
+
+bool parse_lossless_mode(LosslessMode& out, const std::string& name)
+{
+    if(name == "off")
+        out = LOSSLESS_OFF;
+    else if(name == "exact")
+        out = LOSSLESS_EXACT;
+    else if(name == "snap")
+        out = LOSSLESS_SNAP;
+    else
+        return false;
+    
+    return true;
+}
+
+bool pure_yaw(Mat3 rot, double& yaw)
+{
+    const double eps = 1e-9;
+    
+    if(fabs(rot[2]) > eps || fabs(rot[5]) > eps ||
+       fabs(rot[6]) > eps || fabs(rot[7]) > eps ||
+       fabs(rot[8] - 1.0) > eps)
+    {
+        return false;
+    }
+    
+    yaw = atan2(rot[3], rot[0]);
+    return true;
+}
+
+// the first bytes are enough to tell a JPEG from the other inputs
+static bool is_jpeg(const std::string& path)
+{
+    unsigned char magic[3] = {0, 0, 0};
+    
+    FILE* fp = fopen(path.c_str(), "rb");
+    if(!fp)
+        return false;
+    
+    size_t n = fread(magic, 1, 3, fp);
+    fclose(fp);
+    
+    return n == 3 && 
+           magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF;
+}
+
+// libjpeg writes its own JFIF and Adobe markers; everything else saved
+// from the input is passed through unchanged
+static void copy_markers(jpeg_decompress_struct& src,
+    jpeg_compress_struct& dst)
+{
+    for(jpeg_saved_marker_ptr m = src.marker_list; m; m = m->next)
+    {
+        if(dst.write_JFIF_header && m->marker == JPEG_APP0 &&
+           m->data_length >= 5 && memcmp(m->data, "JFIF", 5) == 0)
+        {
+            continue;
+        }
+        
+        if(dst.write_Adobe_marker && m->marker == JPEG_APP0 + 14 &&
+           m->data_length >= 5 && memcmp(m->data, "Adobe", 5) == 0)
+        {
+            continue;
+        }
+        
+        jpeg_write_marker(&dst, m->marker, m->data, m->data_length);
+    }
+}
+
+// turns every block row of each component left by mcus MCU columns
+static void rotate_blocks(jpeg_decompress_struct& cinfo,
+    jvirt_barray_ptr* coefs, size_t mcus)
+{
+    for(int ci = 0; ci < cinfo.num_components; ci++)
+    {
+        jpeg_component_info* comp = &cinfo.comp_info[ci];
+        size_t width = comp->width_in_blocks;
+        size_t shift = (mcus * comp->h_samp_factor) % width;
+        
+        if(shift == 0)
+            continue;
+        
+        vector<JCOEF> row_copy(width * DCTSIZE2);
+        
+        for(JDIMENSION row = 0; row < comp->height_in_blocks;
+            row += comp->v_samp_factor)
+        {
+            JBLOCKARRAY rows = (*cinfo.mem->access_virt_barray)(
+                (j_common_ptr)&cinfo, coefs[ci], row,
+                (JDIMENSION)comp->v_samp_factor, TRUE);
+            
+            for(int r = 0; r < comp->v_samp_factor; r++)
+            {
+                if(row + r >= comp->height_in_blocks)
+                    break;
+                
+                // JBLOCK is an array, so the blocks are moved as bytes
+                memcpy(&row_copy[0], rows[r], width * sizeof(JBLOCK));
+                memcpy(rows[r], &row_copy[shift * DCTSIZE2], 
+                    (width - shift) * sizeof(JBLOCK));
+                memcpy(rows[r] + (width - shift), &row_copy[0], 
+                    shift * sizeof(JBLOCK));
+            }
+        }
+    }
+}
+
+LosslessResult jpeg_lossless_yaw(const std::string& in_path,
+    const std::string& out_path, double yaw, LosslessMode mode,
+    size_t output_width, double& applied_yaw)
+{
+    if(mode == LOSSLESS_OFF)
+        return LOSSLESS_SKIPPED;
+    
+    if(!is_jpeg(in_path))
+    {
+        printf("Lossless:    skipped, input is not JPEG\n");
+        return LOSSLESS_SKIPPED;
+    }
+    
+    FILE* in = fopen(in_path.c_str(), "rb");
+    if(!in)
+    {
+        fprintf(stderr, "[ERROR] Failed to open: %s\n", in_path.c_str());
+        return LOSSLESS_FAILED;
+    }
+    
+    jpeg_decompress_struct src;
+    jpeg_error_mgr src_err;
+    
+    memset(&src, 0, sizeof(src));
+    src.err = jpeg_std_error(&src_err);
+    
+    jpeg_create_decompress(&src);
+    jpeg_stdio_src(&src, in);
+    
+    jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+    for(int i = 0; i < 16; i++)
+        jpeg_save_markers(&src, JPEG_APP0 + i, 0xFFFF);
+    
+    if(jpeg_read_header(&src, TRUE) != JPEG_HEADER_OK)
+    {
+        fprintf(stderr, "[ERROR] Failed to read JPG header: %s\n",
+            in_path.c_str());
+        jpeg_destroy_decompress(&src);
+        fclose(in);
+        return LOSSLESS_FAILED;
+    }
+    
+    size_t width = src.image_width;
+    size_t mcu_width = src.max_h_samp_factor * DCTSIZE;
+    
+    // a partial MCU column at the right edge would end up mid-image
+    const char* reason = 0;
+    
+    if(output_width != 0 && output_width != width)
+        reason = "the output is resized";
+    else if(width % mcu_width != 0)
+        reason = "the width is not a whole number of MCUs";
+    
+    // column x of the output is column x + shift of the input. The
+    // resampler (and the lattice permutations) turn by width-1 columns
+    // per revolution, so the same yaw is measured that way here.
+    double turns = yaw / (2*M_PI);
+    turns -= floor(turns);
+    
+    size_t mcu_count = width / mcu_width;
+    double mcus = turns * (width - 1.0) / mcu_width;
+    double snapped = floor(mcus + 0.5);
+    
+    if(!reason && mode == LOSSLESS_EXACT &&
+       fabs(mcus - snapped) * mcu_width > 1e-3)
+    {
+        reason = "the yaw is not a whole number of MCUs";
+    }
+    
+    if(reason)
+    {
+        printf("Lossless:    skipped, %s (MCU is %lu pixels)\n", reason,
+            mcu_width);
+        jpeg_destroy_decompress(&src);
+        fclose(in);
+        return LOSSLESS_SKIPPED;
+    }
+    
+    size_t shift = (size_t)snapped % mcu_count;
+    
+    // every block is read before anything is written, and the output
+    // goes to a temporary file first, so out_path may be in_path
+    jvirt_barray_ptr* coefs = jpeg_read_coefficients(&src);
+    
+    string temp_path = out_path + ".tmp";
+    
+    FILE* out = fopen(temp_path.c_str(), "wb");
+    if(!out)
+    {
+        perror("Failed to open file for writing");
+        jpeg_destroy_decompress(&src);
+        fclose(in);
+        return LOSSLESS_FAILED;
+    }
+    
+    rotate_blocks(src, coefs, shift);
+    
+    jpeg_compress_struct dst;
+    jpeg_error_mgr dst_err;
+    
+    memset(&dst, 0, sizeof(dst));
+    dst.err = jpeg_std_error(&dst_err);
+    
+    jpeg_create_compress(&dst);
+    jpeg_stdio_dest(&dst, out);
+    
+    jpeg_copy_critical_parameters(&src, &dst);
+    
+    if(src.progressive_mode)
+        jpeg_simple_progression(&dst);
+    
+    jpeg_write_coefficients(&dst, coefs);
+    copy_markers(src, dst);
+    
+    jpeg_finish_compress(&dst);
+    jpeg_destroy_compress(&dst);
+    
+    jpeg_finish_decompress(&src);
+    jpeg_destroy_decompress(&src);
+    
+    bool written = fclose(out) == 0;
+    fclose(in);
+    
+    if(!written || rename(temp_path.c_str(), out_path.c_str()) != 0)
+    {
+        fprintf(stderr, "[ERROR] Failed to write %s\n", out_path.c_str());
+        remove(temp_path.c_str());
+        return LOSSLESS_FAILED;
+    }
+    
+    applied_yaw = 2*M_PI * shift * mcu_width / (width - 1.0);
+    
+    return LOSSLESS_WRITTEN;
+}
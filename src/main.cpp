@@ -2,32 +2,94 @@
 #include "image.h"
 #include "remap.h"
 #include "test.h"
+#include "parallel.h"
+#include "tune.h"
+#include "pyramid.h"
+#include "pipe.h"
+#include "lossless.h"
+#include "shard.h"
+#include "row_progress.h"
+#include "coverage_mask.h"
+#include "memory_plan.h"
+#include "sample_image.h"
 
 #include <cstdio>
 #include <cstdlib>
+#include <cmath>
 #include <vector>
 #include <string>
 #include <cctype>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
 using namespace std;
 
 const char* USAGE =
 
 "Usage: panorotate -i <filename> [-o <filename>] [-f <format>]\n"
-"                  [-q <jpg_quality>] [--test] [--preview]\n"
-"                  [--order <rpy>] [<angles...>]\n"
+"                  [-q <jpg_quality>] [--png-level <n>] [--test]\n"
+"                  [--preview] [--width <pixels>] [--engine <name>]\n"
+"                  [--order <rpy>] [--views <file>] [--threads <n>]\n"
+"                  [--affinity <cpus>] [--schedule <kind>] [--scaling]\n"
+"                  [--heatmap <filename>] [--min-psnr <dB>]\n"
+"                  [--autotune <profile>] [--profile <profile>]\n"
+"                  [--pyramid <base>] [--pyramid-layout <dz|xyz>]\n"
+"                  [--tile-size <pixels>] [--rotations <file>]\n"
+"                  [--tiled-source] [--huge-pages] [--layout-test]\n"
+"                  [--pipe <format> --frame-size <w>x<h>]\n"
+"                  [--lossless <exact|snap|off>] [--band <first>:<end>]\n"
+"                  [--merge <shards...>] [--max-memory <size>]\n"
+"                  [<angles...>]\n"
 "\n"
 "Flags and arguments:\n"
 "    -i filename    specify input filename (required)\n"
-"    -o filename    specify output filename (required except for --test)\n"
+"    -o filename    specify output filename (required except for --test\n"
+"                   and --pyramid). Repeat -o to write several outputs\n"
+"                   from one render: -f, -q, --png-level and --width\n"
+"                   given after an -o apply to that output, and before\n"
+"                   the first -o to all of them. The source is rendered\n"
+"                   once at the widest width and every output is encoded\n"
+"                   at the same time on its own thread; narrower ones\n"
+"                   are area averaged down from the render first.\n"
 "    -f format      specify output format (default is 'TIFF')\n"
 "                   See the table below for full list of possible formats.\n"
 "    -q jpg_quality Integer quality percent to use when saving as JPEG.\n"
 "                   (default is 90)\n"
+"    --png-level n  zlib compression level 0-9 to use when saving as PNG\n"
+"                   (default is 6). Rows are compressed on all threads.\n"
 "    --test         Run the double rotation test and print statistics.\n"
 "                   If no angles are specified by default a 90 degree\n"
 "                   roll is used to test the quality.\n"
+"    --heatmap filename\n"
+"                   With --test, save an image of the per pixel round\n"
+"                   trip error (black is exact, white is >= 0.1).\n"
+"    --min-psnr dB  With --test, exit with an error status if the mean\n"
+"                   PSNR of the round trip falls below this value.\n"
+"    --autotune profile\n"
+"                   Measure round trip quality and speed of the remap\n"
+"                   engines over a grid of sample counts and filter\n"
+"                   widths on the input image, and write the fastest\n"
+"                   setting that reaches --min-psnr (default 40 dB)\n"
+"                   to the given profile file.\n"
+"    --profile profile\n"
+"                   Use the remap settings saved by --autotune.\n"
 "    --preview      Perform a single sample per output pixel to create\n"
-"                   a preview image more quickly.\n"
+"                   a preview image more quickly. The preview has the\n"
+"                   input size; add --width for a smaller one, which\n"
+"                   also lets large JPEGs be decoded at reduced size.\n"
+"    --engine name  Remap engine: 'full3' (default) filters 9x9 bilinear\n"
+"                   samples per pixel, 'fast' takes one sample (same\n"
+"                   as --preview), and 'area' averages each pixel's\n"
+"                   whole footprint from a summed-area table of the\n"
+"                   source in constant time, which also filters large\n"
+"                   footprints near the poles and when shrinking. The\n"
+"                   table takes 32 bytes per source pixel.\n"
+"    --width pixels Width of the output image (default is the input\n"
+"                   width); the height keeps the input aspect ratio.\n"
+"                   JPEG inputs are decoded at 1/2, 1/4 or 1/8 size when\n"
+"                   that still leaves at least twice the output width\n"
+"                   (or the output width itself with --preview).\n"
 "    --order rpy    Rotation sequence to perform indicating order of\n"
 "                   roll (R), pitch (P), and yaw (Y). Only 'R', 'P', 'Y'\n"
 "                   may be used in the argument following --order, though\n"
@@ -36,6 +98,98 @@ const char* USAGE =
 "                   specified then the default order is RPY.\n"
 "                   'RPY' means that first a roll will be performed, then\n"
 "                   a pitch, and finally a yaw.\n"
+"    --views file   Render perspective (rectilinear) views instead of a\n"
+"                   whole panorama. Each line of the file describes one\n"
+"                   view as: <output> <yaw> <pitch> <roll> <hfov> <w> <h>\n"
+"                   with angles in degrees. All views are rendered from a\n"
+"                   single load of the input using the -f format, after\n"
+"                   applying any rotation given by the angles.\n"
+"    --rotations file\n"
+"                   Render several rotations of the input in a single\n"
+"                   pass. Each line of the file is: <output> <angles...>\n"
+"                   with the angles in degrees in --order sequence\n"
+"                   (missing angles are 0). Outputs use the -f format\n"
+"                   and --width, and the source, direction table and\n"
+"                   filter are shared between all of them.\n"
+"    --threads n    Number of worker threads (default: one per cpu or\n"
+"                   the value of OMP_NUM_THREADS).\n"
+"    --affinity cpus\n"
+"                   Pin worker threads to cpus. Either 'compact' (fill\n"
+"                   the allowed cpus in order), 'spread' (space threads\n"
+"                   evenly over the allowed cpus) or a list such as\n"
+"                   0-7,16-23. Thread i runs on the i-th listed cpu;\n"
+"                   decoder and encoder threads run on any of them.\n"
+"    --schedule kind\n"
+"                   How output pixels are divided between threads:\n"
+"                   'static' gives each thread one block of rows, and\n"
+"                   'dynamic' (default) hands out 64x8 tiles on demand.\n"
+"                   The tile size can be set with e.g. dynamic:128x4.\n"
+"    --pyramid base Write the output as a tiled image pyramid of JPEGs\n"
+"                   (quality set by -q) instead of a single image. Rows\n"
+"                   of tiles are rendered and encoded one at a time, so\n"
+"                   the full size output is never held in memory.\n"
+"    --pyramid-layout layout\n"
+"                   'dz' (default) writes a Deep Zoom pyramid as\n"
+"                   base.dzi with tiles in base_files/<level>/<x>_<y>.jpg.\n"
+"                   'xyz' writes map style tiles as base/<z>/<x>/<y>.jpg\n"
+"                   where zoom 0 is the coarsest level that fits one tile.\n"
+"    --tile-size pixels\n"
+"                   Edge length of the pyramid tiles (default is 256).\n"
+"    --scaling      Time the remap at 1 to 64 threads with both\n"
+"                   schedules and print the speedups.\n"
+"    --tiled-source Store the source in 16x16 pixel tiles while\n"
+"                   rendering. Rotated sampling paths then touch fewer\n"
+"                   cache lines and pages, which helps at large sizes.\n"
+"    --huge-pages   Ask for transparent huge pages (2 MiB) for image\n"
+"                   buffers of 2 MiB or more, which cuts TLB misses when\n"
+"                   sampling a large source. Has no effect if the kernel\n"
+"                   has huge pages disabled.\n"
+"    --layout-test  Time the remap from the input scaled to 8K, 16K and\n"
+"                   32K wide with row major and tiled sources (sizes\n"
+"                   that don't fit in memory are skipped).\n"
+"    --pipe format  Read raw frames from stdin and write the rotated\n"
+"                   frames to stdout in the same format, for use in a\n"
+"                   video pipeline. format is rgb24, rgb48 (little\n"
+"                   endian) or rgba. Reading, remapping and writing of\n"
+"                   consecutive frames overlap. -i and -o are not used.\n"
+"    --frame-size WxH\n"
+"                   Size of the --pipe input frames. The output frames\n"
+"                   are --width wide (default the same size).\n"
+"    --lossless mode\n"
+"                   For a JPEG to JPEG pure yaw, move the compressed\n"
+"                   blocks of each row instead of decoding, remapping\n"
+"                   and re-encoding, which is lossless and runs at I/O\n"
+"                   speed. The yaw must move the image by a whole\n"
+"                   number of MCUs (8 or 16 pixels), counting width-1\n"
+"                   pixels per turn like the resampler does, so it is\n"
+"                   360*k*MCU/(width-1) degrees. 'exact' uses this only\n"
+"                   for such yaws, 'snap' rounds any yaw to the nearest\n"
+"                   one and 'off' (the default) never uses it. Other\n"
+"                   jobs, including non-JPEG outputs (see -f), are\n"
+"                   rendered normally and the reason is printed. The\n"
+"                   blocks wrap around every width pixels, and -q is\n"
+"                   ignored. The output may replace the input file.\n"
+"    --band first:end\n"
+"                   Render only output rows first to end-1 into a shard\n"
+"                   file (-o, a TIFF format). Only the source rows the\n"
+"                   band can sample are decoded and held, so separate\n"
+"                   processes or hosts can each render one band of a\n"
+"                   large output with the same arguments.\n"
+"    --merge shards...\n"
+"                   Join the shard files named by all the following\n"
+"                   arguments into the TIFF given by -o (which must come\n"
+"                   first). Rows are copied as stored; nothing is\n"
+"                   resampled. The shards must cover every row once.\n"
+"    --max-memory size\n"
+"                   Keep a render within size bytes (suffix K, M, G or\n"
+"                   T, e.g. 4G). The peak of each way to run it is\n"
+"                   estimated from the input header first, and the\n"
+"                   fastest that fits is used: the whole source in\n"
+"                   memory, the whole source kept in its file's sample\n"
+"                   format, or the output in bands that each decode\n"
+"                   only the source rows they need. Fails before\n"
+"                   loading anything if none fits. The last two need a\n"
+"                   TIFF or JPEG output.\n"
 "    [<angles...>]  Rotation angles in degrees.\n"
 "                   Unspecified angles will be assumed to be zero.\n"
 "                   Extra angles will be ignored.\n"
@@ -45,6 +199,26 @@ const char* USAGE =
 "\n"
 "    This loads input.tif, performs a 90 degree roll, and saves the\n"
 "    output into output.tif in 16-bit RGBA format.\n"
+"\n"
+"    ffmpeg -i in.mp4 -f rawvideo -pix_fmt rgb24 - |\n"
+"        panorotate --pipe rgb24 --frame-size 3840x1920 0 0 90 |\n"
+"        ffmpeg -f rawvideo -pix_fmt rgb24 -s 3840x1920 -i - out.mp4\n"
+"\n"
+"    This yaws every frame of a 360 degree video by 90 degrees without\n"
+"    writing any intermediate image files.\n"
+"\n"
+"    panorotate -i in.tif -o s0.tif --band 0:4000 30 0 0\n"
+"    panorotate -i in.tif -o s1.tif --band 4000:8000 30 0 0\n"
+"    panorotate -o out.tif --merge s0.tif s1.tif\n"
+"\n"
+"    This renders the two halves of an 8000 row output separately (on\n"
+"    any machines) and joins them into out.tif.\n"
+"\n"
+"    panorotate -i in.tif -o master.tif -f TIFF_RGB16 -o web.jpg -f JPEG\n"
+"        -q 85 -o thumb.jpg -f JPEG -q 85 --width 2048 30 0 0\n"
+"\n"
+"    This decodes and rotates in.tif once and writes a 16-bit TIFF\n"
+"    master, a JPEG and a 2048 pixel wide JPEG thumbnail from it.\n"
 ;
 
 
@@ -55,12 +229,20 @@ struct SaveFormat
         const std::string&,
         ImageSaveParams);
     
+    // for formats that can be written a band of rows at a time
+    typedef RowWriter* (*OpenFunc)(
+        const std::string&,
+        size_t, size_t,
+        ImageSaveParams);
+    
     string flag_name;
     SaveFunc save;
+    OpenFunc open;
     string description;
     
-    SaveFormat(const string& flag, SaveFunc func, const string& desc) 
-        : flag_name(flag), save(func), description(desc) {}
+    SaveFormat(const string& flag, SaveFunc func, const string& desc,
+        OpenFunc open_func = 0) 
+        : flag_name(flag), save(func), open(open_func), description(desc) {}
     
     bool match(const string& input)
     {
@@ -90,6 +272,14 @@ void save_tiff_rgb8(
     save_tiff(img, path, params);
 }
 
+RowWriter* open_tiff_rgb8(const std::string& path, size_t width, 
+    size_t height, ImageSaveParams params)
+{
+    params.spp = 3;
+    params.bps = 8;
+    return open_tiff_writer(path, width, height, params);
+}
+
 void save_tiff_rgba8(
     const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
 {
@@ -98,6 +288,14 @@ void save_tiff_rgba8(
     save_tiff(img, path, params);
 }
 
+RowWriter* open_tiff_rgba8(const std::string& path, size_t width, 
+    size_t height, ImageSaveParams params)
+{
+    params.spp = 4;
+    params.bps = 8;
+    return open_tiff_writer(path, width, height, params);
+}
+
 void save_tiff_rgb16(
     const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
 {
@@ -106,6 +304,14 @@ void save_tiff_rgb16(
     save_tiff(img, path, params);
 }
 
+RowWriter* open_tiff_rgb16(const std::string& path, size_t width, 
+    size_t height, ImageSaveParams params)
+{
+    params.spp = 3;
+    params.bps = 16;
+    return open_tiff_writer(path, width, height, params);
+}
+
 void save_tiff_rgba16(
     const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
 {
@@ -114,14 +320,146 @@ void save_tiff_rgba16(
     save_tiff(img, path, params);
 }
 
+RowWriter* open_tiff_rgba16(const std::string& path, size_t width, 
+    size_t height, ImageSaveParams params)
+{
+    params.spp = 4;
+    params.bps = 16;
+    return open_tiff_writer(path, width, height, params);
+}
+
+void save_tiff_rgb16f(
+    const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
+{
+    params.spp = 3;
+    params.bps = 16;
+    params.format = SAMPLE_FLOAT;
+    save_tiff(img, path, params);
+}
+
+RowWriter* open_tiff_rgb16f(const std::string& path, size_t width, 
+    size_t height, ImageSaveParams params)
+{
+    params.spp = 3;
+    params.bps = 16;
+    params.format = SAMPLE_FLOAT;
+    return open_tiff_writer(path, width, height, params);
+}
+
+void save_tiff_rgba16f(
+    const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
+{
+    params.spp = 4;
+    params.bps = 16;
+    params.format = SAMPLE_FLOAT;
+    save_tiff(img, path, params);
+}
+
+RowWriter* open_tiff_rgba16f(const std::string& path, size_t width, 
+    size_t height, ImageSaveParams params)
+{
+    params.spp = 4;
+    params.bps = 16;
+    params.format = SAMPLE_FLOAT;
+    return open_tiff_writer(path, width, height, params);
+}
+
+void save_tiff_rgb32f(
+    const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
+{
+    params.spp = 3;
+    params.bps = 32;
+    params.format = SAMPLE_FLOAT;
+    save_tiff(img, path, params);
+}
+
+RowWriter* open_tiff_rgb32f(const std::string& path, size_t width, 
+    size_t height, ImageSaveParams params)
+{
+    params.spp = 3;
+    params.bps = 32;
+    params.format = SAMPLE_FLOAT;
+    return open_tiff_writer(path, width, height, params);
+}
+
+void save_tiff_rgba32f(
+    const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
+{
+    params.spp = 4;
+    params.bps = 32;
+    params.format = SAMPLE_FLOAT;
+    save_tiff(img, path, params);
+}
+
+RowWriter* open_tiff_rgba32f(const std::string& path, size_t width, 
+    size_t height, ImageSaveParams params)
+{
+    params.spp = 4;
+    params.bps = 32;
+    params.format = SAMPLE_FLOAT;
+    return open_tiff_writer(path, width, height, params);
+}
+
+void save_png_rgb8(
+    const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
+{
+    params.spp = 3;
+    params.bps = 8;
+    save_png(img, path, params);
+}
+
+void save_png_rgba8(
+    const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
+{
+    params.spp = 4;
+    params.bps = 8;
+    save_png(img, path, params);
+}
+
+void save_png_rgb16(
+    const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
+{
+    params.spp = 3;
+    params.bps = 16;
+    save_png(img, path, params);
+}
+
+void save_png_rgba16(
+    const Image<RGBAF>& img, const std::string& path, ImageSaveParams params)
+{
+    params.spp = 4;
+    params.bps = 16;
+    save_png(img, path, params);
+}
+
 SaveFormat save_format_table[] = {
-    SaveFormat("TIFF", save_tiff,  "(default) -- matches bps/spp from input"),
-    SaveFormat("JPG", save_jpeg,   "8-bit RGB JPEG (default q=90)"),
-    SaveFormat("JPEG", save_jpeg,  "(synonym; same as above)"),
-    SaveFormat("TIFF_RGB8", save_tiff_rgb8,     "8-bit  RGB  TIFF"),
-    SaveFormat("TIFF_RGB16", save_tiff_rgb16,   "16-bit RGB  TIFF"),
-    SaveFormat("TIFF_RGBA8", save_tiff_rgba8,   "8-bit  RGBA TIFF"),
-    SaveFormat("TIFF_RGBA16", save_tiff_rgba16, "16-bit RGBA TIFF")
+    SaveFormat("TIFF", save_tiff,  "(default) -- matches format of input",
+        open_tiff_writer),
+    SaveFormat("JPG", save_jpeg,   "8-bit RGB JPEG (default q=90)",
+        open_jpeg_writer),
+    SaveFormat("JPEG", save_jpeg,  "(synonym; same as above)",
+        open_jpeg_writer),
+    SaveFormat("TIFF_RGB8", save_tiff_rgb8,     "8-bit  RGB  TIFF",
+        open_tiff_rgb8),
+    SaveFormat("TIFF_RGB16", save_tiff_rgb16,   "16-bit RGB  TIFF",
+        open_tiff_rgb16),
+    SaveFormat("TIFF_RGBA8", save_tiff_rgba8,   "8-bit  RGBA TIFF",
+        open_tiff_rgba8),
+    SaveFormat("TIFF_RGBA16", save_tiff_rgba16, "16-bit RGBA TIFF",
+        open_tiff_rgba16),
+    SaveFormat("TIFF_RGB16F", save_tiff_rgb16f,   "16-bit half float RGB  TIFF",
+        open_tiff_rgb16f),
+    SaveFormat("TIFF_RGBA16F", save_tiff_rgba16f, "16-bit half float RGBA TIFF",
+        open_tiff_rgba16f),
+    SaveFormat("TIFF_RGB32F", save_tiff_rgb32f,   "32-bit float RGB  TIFF",
+        open_tiff_rgb32f),
+    SaveFormat("TIFF_RGBA32F", save_tiff_rgba32f, "32-bit float RGBA TIFF",
+        open_tiff_rgba32f),
+    SaveFormat("PNG", save_png,  "matches spp from input; 16-bit unless 8-bit"),
+    SaveFormat("PNG_RGB8", save_png_rgb8,     "8-bit  RGB  PNG"),
+    SaveFormat("PNG_RGB16", save_png_rgb16,   "16-bit RGB  PNG"),
+    SaveFormat("PNG_RGBA8", save_png_rgba8,   "8-bit  RGBA PNG"),
+    SaveFormat("PNG_RGBA16", save_png_rgba16, "16-bit RGBA PNG")
 };
 
 void print_save_formats()
@@ -248,14 +586,243 @@ Mat3 make_rotation(const vector<RotType>& order,
     return accum;
 }
 
+struct ViewSpec
+{
+    string output_filename;
+    double yaw;     // degrees
+    double pitch;
+    double roll;
+    double hfov;
+    size_t width;
+    size_t height;
+};
+
+// one view per line: <output> <yaw> <pitch> <roll> <hfov> <width> <height>
+// blank lines and lines starting with '#' are ignored
+bool load_views(vector<ViewSpec>& out, const string& path)
+{
+    ifstream in(path.c_str());
+    
+    if(!in)
+    {
+        fprintf(stderr, "[ERROR] Failed to open views file: %s\n", 
+            path.c_str());
+        return false;
+    }
+    
+    string line;
+    size_t line_number = 0;
+    
+    while(getline(in, line))
+    {
+        line_number++;
+        
+        size_t start = line.find_first_not_of(" \t\r");
+        if(start == string::npos || line.at(start) == '#')
+            continue;
+        
+        istringstream fields(line);
+        ViewSpec view;
+        
+        if(!(fields >> view.output_filename >> view.yaw >> view.pitch 
+                    >> view.roll >> view.hfov >> view.width >> view.height))
+        {
+            fprintf(stderr, "[ERROR] Bad view on line %lu of %s\n",
+                line_number, path.c_str());
+            return false;
+        }
+        
+        if(view.hfov <= 0 || view.hfov >= 180 || 
+           view.width == 0 || view.height == 0)
+        {
+            fprintf(stderr, "[ERROR] Invalid view size/fov on line %lu of %s\n",
+                line_number, path.c_str());
+            return false;
+        }
+        
+        out.push_back(view);
+    }
+    
+    if(out.empty())
+    {
+        fprintf(stderr, "[ERROR] No views found in %s\n", path.c_str());
+        return false;
+    }
+    
+    return true;
+}
+
+struct RotationSpec
+{
+    string output_filename;
+    vector<double> angles;  // degrees, in --order sequence
+};
+
+// one output per line: <output> <angles...>
+// blank lines and lines starting with '#' are ignored
+bool load_rotations(vector<RotationSpec>& out, const string& path)
+{
+    ifstream in(path.c_str());
+    
+    if(!in)
+    {
+        fprintf(stderr, "[ERROR] Failed to open rotations file: %s\n", 
+            path.c_str());
+        return false;
+    }
+    
+    string line;
+    size_t line_number = 0;
+    
+    while(getline(in, line))
+    {
+        line_number++;
+        
+        size_t start = line.find_first_not_of(" \t\r");
+        if(start == string::npos || line.at(start) == '#')
+            continue;
+        
+        istringstream fields(line);
+        RotationSpec spec;
+        
+        if(!(fields >> spec.output_filename))
+        {
+            fprintf(stderr, "[ERROR] Bad rotation on line %lu of %s\n",
+                line_number, path.c_str());
+            return false;
+        }
+        
+        double angle;
+        while(fields >> angle)
+        {
+            spec.angles.push_back(angle);
+        }
+        
+        if(!fields.eof())
+        {
+            fprintf(stderr, "[ERROR] Bad angle on line %lu of %s\n",
+                line_number, path.c_str());
+            return false;
+        }
+        
+        out.push_back(spec);
+    }
+    
+    if(out.empty())
+    {
+        fprintf(stderr, "[ERROR] No rotations found in %s\n", path.c_str());
+        return false;
+    }
+    
+    return true;
+}
+
+// a file written from the render. -f, -q, --png-level and --width given
+// before the first -o apply to every output, later ones to the last -o.
+struct OutputSpec
+{
+    string filename;
+    SaveFormat* format;
+    ImageSaveParams params;
+    size_t width;           // 0 = same as input
+    
+    OutputSpec() : format(&save_format_table[0]), width(0) {}
+};
+
+// the plain TIFF and PNG formats follow the input's samples
+void match_input_samples(ImageSaveParams& params, const SaveFormat& format,
+    const ImageLoadResult& input)
+{
+    if(format.flag_name == "TIFF")
+    {
+        params.bps = input.bps;
+        params.spp = input.spp;
+        params.format = input.format;
+    }
+    
+    if(format.flag_name == "PNG")
+    {
+        bool is_8bit = input.bps == 8 && input.format == SAMPLE_UINT;
+        
+        params.bps = is_8bit ? 8 : 16;
+        params.spp = input.spp;
+    }
+}
+
+// encodes every output from one render at the same time, each on its own
+// thread; outputs narrower than the render are area averaged down to
+// their width (the height keeps the source aspect ratio) first
+void save_outputs(const Image<RGBAF>& rendered, 
+    const vector<OutputSpec>& outputs, size_t source_width, 
+    size_t source_height)
+{
+    vector<thread> encoders;
+    
+    // the encoders' own OpenMP regions (PNG deflate, downscale) follow
+    // --threads and stay on the --affinity cpus
+    int threads = thread_count();
+    
+    for(size_t i = 0; i < outputs.size(); i++)
+    {
+        encoders.push_back(thread([&rendered, &outputs, i, source_width,
+            source_height, threads]()
+        {
+            unpin_thread();
+            set_thread_count(threads);
+            
+            const OutputSpec& output = outputs.at(i);
+            size_t width = output.width ? output.width : rendered.width;
+            
+            if(width == rendered.width)
+            {
+                output.format->save(rendered, output.filename, 
+                    output.params);
+                return;
+            }
+            
+            size_t height = (width * source_height + source_width/2) / 
+                source_width;
+            
+            Image<RGBAF> smaller;
+            downscale(smaller, rendered, width, height ? height : 1);
+            output.format->save(smaller, output.filename, output.params);
+        }));
+    }
+    
+    for(size_t i = 0; i < encoders.size(); i++)
+    {
+        encoders.at(i).join();
+    }
+}
+
 int main(int argc, char** argv)
 {
     SaveFormat* save_format = &save_format_table[0];
     
     string input_filename;
     string output_filename;
+    string views_filename;  // non-empty when rendering perspective views
+    string rotations_filename;  // non-empty when rendering many rotations
+    string affinity;        // cpu pinning request; empty means don't pin
+    string heatmap_filename;    // --test error heatmap output
+    string autotune_filename;   // profile written by --autotune
+    string profile_filename;    // profile read by --profile
+    string pyramid_base;        // non-empty when writing a tile pyramid
+    double min_psnr = 0.0;      // --test quality gate; 0 disables it
     bool run_test = false;  // true if double rotate test is requested
+    bool run_scaling = false;   // true if thread scaling test is requested
+    bool run_layout_test = false;   // true if source layout test requested
+    bool tiled_source = false;  // sample the source from 16x16 tiles
+    bool pipe_mode = false;     // raw frames from stdin to stdout
     bool preview_mode = false;  // true when user wants quick result
+    string engine_choice;       // --engine; overrides any --profile
+    LosslessMode lossless_mode = LOSSLESS_OFF;  // JPEG block yaw
+    size_t band_first = 0;      // --band: output rows band_first ..
+    size_t band_end = 0;        // band_end-1 (0 = whole output)
+    vector<string> merge_inputs;    // shards to join with --merge
+    bool merge_mode = false;
+    size_t output_width = 0;    // 0 = same as input
+    size_t max_memory = 0;      // --max-memory in bytes (0 = no limit)
 
     vector<RotType> rotation_sequence;
     rotation_sequence.push_back(ROT_X);
@@ -270,6 +837,20 @@ int main(int argc, char** argv)
     Mat3 rotation_matrix = ident();
     
     ImageSaveParams save_params;
+    RemapParams remap_params;
+    PyramidParams pyramid_params;
+    PipeParams pipe_params;
+    
+    // every -o, with its own format, quality and width; the defaults come
+    // from the flags before the first one
+    OutputSpec output_defaults;
+    vector<OutputSpec> outputs;
+    
+    // the output that -f, -q, --png-level and --width apply to
+    auto current_output = [&]() -> OutputSpec&
+    {
+        return outputs.empty() ? output_defaults : outputs.back();
+    };
     
     
     if(argc <= 1)
@@ -294,150 +875,787 @@ int main(int argc, char** argv)
             continue;
         }
         
-        if(arg == "--preview" || arg == "-preview")
-        {
-            preview_mode = true;
-            continue;
-        }
-        
-        if(arg == "--order" || arg == "-order")
+        if(arg == "--heatmap" || arg == "-heatmap")
         {
             i++;
             
             if(i >= argc)
             {
                 fprintf(stderr, 
-                    "[ERROR] Expected rotation order in arguments\n");
+                    "[ERROR] Expected heatmap filename in arguments\n");
                 return EXIT_FAILURE;
             }
             
-            bool ok = parse_order(rotation_sequence, argv[i]);
+            heatmap_filename = argv[i];
+            continue;
+        }
+        
+        if(arg == "--min-psnr" || arg == "-min-psnr")
+        {
+            i++;
             
-            if(!ok)
+            // a typo must not turn into 0 dB and pass every check
+            char* end = 0;
+            
+            if(i < argc)
+                min_psnr = strtod(argv[i], &end);
+            
+            if(i >= argc || end == argv[i] || *end != '\0' ||
+               !isfinite(min_psnr))
             {
-                fprintf(stderr, "[ERROR] Failed to parse rotation order\n");
+                fprintf(stderr, "[ERROR] Expected number after --min-psnr\n");
                 return EXIT_FAILURE;
             }
+            
+            continue;
         }
         
-        if(arg == "-i")
+        if(arg == "--autotune" || arg == "-autotune" ||
+           arg == "--profile"  || arg == "-profile")
         {
             i++;
             
             if(i >= argc)
             {
                 fprintf(stderr, 
-                    "[ERROR] Expected input filename in arguments\n");
+                    "[ERROR] Expected profile filename after %s\n",
+                    arg.c_str());
                 return EXIT_FAILURE;
             }
             
-            input_filename = argv[i];
+            if(arg == "--autotune" || arg == "-autotune")
+                autotune_filename = argv[i];
+            else
+                profile_filename = argv[i];
+            
             continue;
         }
         
-        if(arg == "-o")
+        if(arg == "--scaling" || arg == "-scaling")
+        {
+            run_scaling = true;
+            continue;
+        }
+        
+        if(arg == "--pipe" || arg == "-pipe")
         {
             i++;
             
-            if(i >= argc)
+            if(i >= argc || !parse_pipe_format(pipe_params.format, argv[i]))
             {
-                fprintf(stderr, 
-                    "[ERROR] Expected output filename in arguments\n");
+                fprintf(stderr, "[ERROR] Expected rgb24, rgb48 or rgba "
+                    "after --pipe\n");
                 return EXIT_FAILURE;
             }
             
-            output_filename = argv[i];
+            pipe_mode = true;
             continue;
         }
         
-        if(arg == "-f")
+        if(arg == "--frame-size" || arg == "-frame-size")
         {
             i++;
             
-            if(i >= argc)
+            unsigned long w = 0, h = 0;
+            
+            if(i >= argc || sscanf(argv[i], "%lux%lu", &w, &h) != 2 || 
+               w < 2 || h < 2)
             {
-                fprintf(stderr, 
-                    "[ERROR] Expected output format after -f flag\n");
+                fprintf(stderr, "[ERROR] Expected <width>x<height> after "
+                    "--frame-size\n");
                 return EXIT_FAILURE;
             }
             
-            save_format = find_save_format(argv[i]);
+            pipe_params.width = w;
+            pipe_params.height = h;
+            continue;
+        }
+        
+        if(arg == "--layout-test" || arg == "-layout-test")
+        {
+            run_layout_test = true;
+            continue;
+        }
+        
+        if(arg == "--tiled-source" || arg == "-tiled-source")
+        {
+            tiled_source = true;
+            continue;
+        }
+        
+        if(arg == "--huge-pages" || arg == "-huge-pages")
+        {
+            set_huge_pages(true);
+            continue;
+        }
+        
+        if(arg == "--max-memory" || arg == "-max-memory")
+        {
+            i++;
             
-            if(!save_format)
+            if(i >= argc || !parse_memory_size(max_memory, argv[i]))
             {
-                fprintf(stderr, "[ERROR] Unknown save format: %s\n", argv[i]);
-                print_save_formats();
+                fprintf(stderr, "[ERROR] Expected a size such as 512M or 4G "
+                    "after --max-memory\n");
                 return EXIT_FAILURE;
             }
             
             continue;
         }
         
-        if(arg == "-q")
+        if(arg == "--threads" || arg == "-threads")
         {
             i++;
             
-            if(i >= argc)
+            if(i >= argc || atoi(argv[i]) <= 0)
             {
-                fprintf(stderr, "[ERROR] Expected integer after -q flag\n");
+                fprintf(stderr, 
+                    "[ERROR] Expected positive thread count after --threads\n");
                 return EXIT_FAILURE;
             }
             
-            save_params.quality = atoi(argv[i]);
+            set_thread_count(atoi(argv[i]));
             continue;
         }
         
-        double angle = 0.0;
+        if(arg == "--affinity" || arg == "-affinity")
+        {
+            i++;
+            
+            if(i >= argc)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected cpu list after --affinity\n");
+                return EXIT_FAILURE;
+            }
+            
+            affinity = argv[i];
+            continue;
+        }
+        
+        if(arg == "--schedule" || arg == "-schedule")
+        {
+            i++;
+            
+            if(i >= argc || !parse_schedule(remap_params.schedule, argv[i]))
+            {
+                fprintf(stderr, "[ERROR] Expected 'static' or "
+                    "'dynamic[:WxH]' after --schedule\n");
+                return EXIT_FAILURE;
+            }
+            
+            continue;
+        }
+        
+        if(arg == "--width" || arg == "-width")
+        {
+            i++;
+            
+            if(i >= argc || atol(argv[i]) <= 0)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected positive width after --width\n");
+                return EXIT_FAILURE;
+            }
+            
+            current_output().width = atol(argv[i]);
+            continue;
+        }
+        
+        if(arg == "--preview" || arg == "-preview")
+        {
+            preview_mode = true;
+            continue;
+        }
+        
+        if(arg == "--engine" || arg == "-engine")
+        {
+            i++;
+            
+            RemapEngine engine;
+            
+            if(i >= argc || !parse_engine(engine, argv[i]))
+            {
+                fprintf(stderr, "[ERROR] Expected full3, fast or area "
+                    "after --engine\n");
+                return EXIT_FAILURE;
+            }
+            
+            engine_choice = argv[i];
+            continue;
+        }
+        
+        if(arg == "--lossless" || arg == "-lossless")
+        {
+            i++;
+            
+            if(i >= argc || !parse_lossless_mode(lossless_mode, argv[i]))
+            {
+                fprintf(stderr, "[ERROR] Expected exact, snap or off "
+                    "after --lossless\n");
+                return EXIT_FAILURE;
+            }
+            
+            continue;
+        }
+        
+        if(arg == "--band" || arg == "-band")
+        {
+            i++;
+            
+            if(i >= argc || !parse_band(band_first, band_end, argv[i]))
+            {
+                fprintf(stderr, "[ERROR] Expected rows as first:end after "
+                    "--band\n");
+                return EXIT_FAILURE;
+            }
+            
+            continue;
+        }
+        
+        // every remaining argument names a shard
+        if(arg == "--merge" || arg == "-merge")
+        {
+            merge_mode = true;
+            merge_inputs.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        
+        if(arg == "--order" || arg == "-order")
+        {
+            i++;
+            
+            if(i >= argc)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected rotation order in arguments\n");
+                return EXIT_FAILURE;
+            }
+            
+            bool ok = parse_order(rotation_sequence, argv[i]);
+            
+            if(!ok)
+            {
+                fprintf(stderr, "[ERROR] Failed to parse rotation order\n");
+                return EXIT_FAILURE;
+            }
+        }
+        
+        if(arg == "--views" || arg == "-views")
+        {
+            i++;
+            
+            if(i >= argc)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected views filename in arguments\n");
+                return EXIT_FAILURE;
+            }
+            
+            views_filename = argv[i];
+            continue;
+        }
+        
+        if(arg == "--pyramid" || arg == "-pyramid")
+        {
+            i++;
+            
+            if(i >= argc)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected pyramid base name in arguments\n");
+                return EXIT_FAILURE;
+            }
+            
+            pyramid_base = argv[i];
+            continue;
+        }
+        
+        if(arg == "--pyramid-layout" || arg == "-pyramid-layout")
+        {
+            i++;
+            
+            if(i >= argc || 
+               !parse_pyramid_layout(pyramid_params.layout, argv[i]))
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected 'dz' or 'xyz' after --pyramid-layout\n");
+                return EXIT_FAILURE;
+            }
+            
+            continue;
+        }
+        
+        if(arg == "--tile-size" || arg == "-tile-size")
+        {
+            i++;
+            
+            if(i >= argc || atoi(argv[i]) < 2 || atoi(argv[i]) % 2 != 0)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected even tile size after --tile-size\n");
+                return EXIT_FAILURE;
+            }
+            
+            pyramid_params.tile_size = atoi(argv[i]);
+            continue;
+        }
+        
+        if(arg == "--rotations" || arg == "-rotations")
+        {
+            i++;
+            
+            if(i >= argc)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected rotations filename in arguments\n");
+                return EXIT_FAILURE;
+            }
+            
+            rotations_filename = argv[i];
+            continue;
+        }
+        
+        if(arg == "-i")
+        {
+            i++;
+            
+            if(i >= argc)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected input filename in arguments\n");
+                return EXIT_FAILURE;
+            }
+            
+            input_filename = argv[i];
+            continue;
+        }
+        
+        if(arg == "-o")
+        {
+            i++;
+            
+            if(i >= argc)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected output filename in arguments\n");
+                return EXIT_FAILURE;
+            }
+            
+            outputs.push_back(output_defaults);
+            outputs.back().filename = argv[i];
+            continue;
+        }
+        
+        if(arg == "-f")
+        {
+            i++;
+            
+            if(i >= argc)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected output format after -f flag\n");
+                return EXIT_FAILURE;
+            }
+            
+            SaveFormat* format = find_save_format(argv[i]);
+            
+            if(!format)
+            {
+                fprintf(stderr, "[ERROR] Unknown save format: %s\n", argv[i]);
+                print_save_formats();
+                return EXIT_FAILURE;
+            }
+            
+            current_output().format = format;
+            continue;
+        }
+        
+        if(arg == "--png-level" || arg == "-png-level")
+        {
+            i++;
+            
+            if(i >= argc || atoi(argv[i]) < 0 || atoi(argv[i]) > 9)
+            {
+                fprintf(stderr, 
+                    "[ERROR] Expected level 0-9 after --png-level\n");
+                return EXIT_FAILURE;
+            }
+            
+            current_output().params.png_level = atoi(argv[i]);
+            continue;
+        }
+        
+        if(arg == "-q")
+        {
+            i++;
+            
+            if(i >= argc)
+            {
+                fprintf(stderr, "[ERROR] Expected integer after -q flag\n");
+                return EXIT_FAILURE;
+            }
+            
+            current_output().params.quality = atoi(argv[i]);
+            continue;
+        }
+        
+        double angle = 0.0;
         if(sscanf(argv[i], "%lf", &angle))
         {
-            rotation_angles.push_back(angle);
+            rotation_angles.push_back(angle);
+        }
+    }
+    
+    // the first output is the one that is rendered; any others are
+    // encoded from that render (see save_outputs)
+    const OutputSpec& primary = outputs.empty() ? output_defaults
+                                                : outputs.front();
+    
+    output_filename = primary.filename;
+    save_format = primary.format;
+    save_params = primary.params;
+    output_width = primary.width;
+    
+    
+    // thread placement depends on the final thread count, so it is
+    // applied only once all arguments have been seen
+    if(affinity.size() != 0)
+    {
+        vector<int> cpus;
+        
+        if(!parse_affinity(cpus, affinity))
+        {
+            fprintf(stderr, "[ERROR] Failed to parse cpu affinity: %s\n",
+                affinity.c_str());
+            return EXIT_FAILURE;
+        }
+        
+        if(!pin_threads(cpus))
+        {
+            fprintf(stderr, "[WARNING] Thread affinity only partly applied\n");
+        }
+    }
+    
+    if(profile_filename.size() != 0 && 
+       !load_profile(remap_params, profile_filename))
+    {
+        return EXIT_FAILURE;
+    }
+    
+    if(engine_choice.size() != 0)
+    {
+        parse_engine(remap_params.engine, engine_choice);
+    }
+    
+    if(preview_mode)
+    {
+        remap_params.engine = ENGINE_FAST;
+    }
+    
+    // sanity check rotation angles/order and construct rotation
+    rotation_angles_specified = rotation_angles.size();
+    
+    if(rotation_sequence.size() > rotation_angles.size() && 
+       rotations_filename.size() == 0 && !merge_mode)
+    {
+        fprintf(stderr, "[WARNING] Assuming unspecified angles are 0\n");
+    }
+    
+    while(rotation_sequence.size() > rotation_angles.size())
+    {
+        rotation_angles.push_back(0.0);
+    }
+    
+    if(rotation_sequence.size() < rotation_angles.size())
+    {
+        fprintf(stderr, "[WARNING] Extra angles are being ignored!\n");
+    }
+    
+    rotation_matrix = make_rotation(rotation_sequence, rotation_angles);
+    
+    
+    // raw video frames need neither input nor output files
+    if(pipe_mode)
+    {
+        if(pipe_params.width == 0)
+        {
+            fprintf(stderr, "[ERROR] --pipe needs the input --frame-size\n");
+            return EXIT_FAILURE;
+        }
+        
+        pipe_params.output_width = output_width ? output_width 
+                                                : pipe_params.width;
+        pipe_params.output_height = 
+            (pipe_params.output_width * pipe_params.height + 
+             pipe_params.width/2) / pipe_params.width;
+        
+        if(pipe_params.output_height < 2)
+            pipe_params.output_height = 2;
+        
+        fprintf(stderr, "Piping %lux%lu frames to %lux%lu\n", 
+            pipe_params.width, pipe_params.height, 
+            pipe_params.output_width, pipe_params.output_height);
+        
+        return run_pipe(pipe_params, rotation_matrix, remap_params) ? 
+            0 : EXIT_FAILURE;
+    }
+    
+    // shards are joined without any input image or rotation
+    if(merge_mode)
+    {
+        if(output_filename.size() == 0)
+        {
+            fprintf(stderr, "[ERROR] --merge needs -o before it\n");
+            return EXIT_FAILURE;
+        }
+        
+        printf("Merging %lu shards into %s\n", merge_inputs.size(),
+            output_filename.c_str());
+        
+        return merge_shards(merge_inputs, output_filename) ? 
+            0 : EXIT_FAILURE;
+    }
+    
+    // sanity check file arguments and load input image
+    Image<RGBAF> src, dst;
+    
+    if(input_filename.size() == 0)
+    {
+        fprintf(stderr, "[ERROR] Cannot proceed without input file\n");
+        return EXIT_FAILURE;
+    }
+    
+    vector<ViewSpec> views;
+    
+    if(views_filename.size() != 0 && !load_views(views, views_filename))
+    {
+        return EXIT_FAILURE;
+    }
+    
+    vector<RotationSpec> rotations;
+    
+    if(rotations_filename.size() != 0 && 
+       !load_rotations(rotations, rotations_filename))
+    {
+        return EXIT_FAILURE;
+    }
+    
+    if(!run_test && !run_scaling && !run_layout_test && 
+       views.empty() && rotations.empty() &&
+       autotune_filename.size() == 0 && pyramid_base.size() == 0 &&
+       output_filename.size() == 0)
+    {
+        fprintf(stderr, "[ERROR] No output filename specified\n");
+        return EXIT_FAILURE;
+    }
+    
+    // a smaller output only needs a smaller source; the full filter wants
+    // about two source pixels per output pixel, a preview needs one
+    ImageLoadParams load_params;
+    
+    bool plain_render = !run_test && !run_scaling && !run_layout_test &&
+                        views.empty() &&
+                        autotune_filename.size() == 0 && rotations.empty();
+    
+    // several outputs share a render at the widest of their widths
+    if(outputs.size() > 1)
+    {
+        if(!plain_render || pyramid_base.size() != 0 || band_end != 0 ||
+           max_memory != 0 || lossless_mode != LOSSLESS_OFF)
+        {
+            fprintf(stderr, "[ERROR] Several -o outputs need a plain render "
+                "(no --pyramid, --band, --max-memory or --lossless)\n");
+            return EXIT_FAILURE;
+        }
+        
+        for(size_t i = 0; i < outputs.size(); i++)
+        {
+            if(outputs.at(i).width == 0)
+            {
+                output_width = 0;
+                break;
+            }
+            
+            output_width = max(output_width, outputs.at(i).width);
         }
     }
     
+    if(plain_render && output_width > 0)
+    {
+        load_params.min_width = preview_mode ? output_width : 2*output_width;
+    }
     
-    // sanity check rotation angles/order and construct rotation
-    rotation_angles_specified = rotation_angles.size();
+    // a pure yaw between JPEGs can skip decoding altogether
+    double yaw = 0.0;
+    
+    const char* lossless_skipped = 0;
     
-    if(rotation_sequence.size() > rotation_angles.size())
+    if(lossless_mode != LOSSLESS_OFF)
     {
-        fprintf(stderr, "[WARNING] Assuming unspecified angles are 0\n");
+        if(!plain_render || pyramid_base.size() != 0)
+            lossless_skipped = "only plain renders can be lossless";
+        else if(save_format->save != save_jpeg)
+            lossless_skipped = "output is not JPEG (use -f JPEG)";
+        else if(!pure_yaw(rotation_matrix, yaw))
+            lossless_skipped = "the rotation is not a pure yaw";
+        
+        if(lossless_skipped)
+            printf("Lossless:    skipped, %s\n", lossless_skipped);
     }
     
-    while(rotation_sequence.size() > rotation_angles.size())
+    if(lossless_mode != LOSSLESS_OFF && !lossless_skipped)
     {
-        rotation_angles.push_back(0.0);
+        double applied_yaw = 0.0;
+        
+        LosslessResult lossless = jpeg_lossless_yaw(input_filename, 
+            output_filename, yaw, lossless_mode, output_width, applied_yaw);
+        
+        if(lossless == LOSSLESS_FAILED)
+            return EXIT_FAILURE;
+        
+        if(lossless == LOSSLESS_WRITTEN)
+        {
+            printf("Input:       %s\n", input_filename.c_str());
+            printf("Output:      %s\n", output_filename.c_str());
+            printf("Lossless:    yaw %g (DCT blocks moved, not resampled)\n",
+                rad2deg(applied_yaw));
+            return 0;
+        }
     }
     
-    if(rotation_sequence.size() < rotation_angles.size())
+    // a shard only decodes the source rows its band of the output can
+    // sample, which needs the output height before the image is loaded
+    if(band_end != 0)
     {
-        fprintf(stderr, "[WARNING] Extra angles are being ignored!\n");
+        if(!plain_render || pyramid_base.size() != 0 || !save_format->open ||
+           save_format->flag_name.compare(0, 4, "TIFF") != 0)
+        {
+            fprintf(stderr, "[ERROR] --band renders a single TIFF output\n");
+            return EXIT_FAILURE;
+        }
+        
+        size_t width, height;
+        
+        if(!read_image_size(input_filename, load_params, width, height))
+            return EXIT_FAILURE;
+        
+        size_t band_width = output_width ? output_width : width;
+        size_t band_height = (band_width * height + width/2) / width;
+        
+        if(band_height == 0)
+            band_height = 1;
+        
+        if(band_end > band_height)
+        {
+            fprintf(stderr, "[ERROR] --band %lu:%lu is past the last output "
+                "row (%lu)\n", band_first, band_end, band_height - 1);
+            return EXIT_FAILURE;
+        }
+        
+        source_row_range(rotation_matrix, band_height, band_first, band_end,
+            load_params.first_row_fraction, load_params.last_row_fraction);
     }
     
-    rotation_matrix = make_rotation(rotation_sequence, rotation_angles);
+    // with a memory budget the way to render is chosen from the header,
+    // before anything is allocated
+    RenderJob job;
+    MemoryPlan memory_plan;
+    
+    if(max_memory != 0)
+    {
+        if(!plain_render || pyramid_base.size() != 0 || band_end != 0 ||
+           tiled_source)
+        {
+            fprintf(stderr, "[ERROR] --max-memory plans single output "
+                "renders only\n");
+            return EXIT_FAILURE;
+        }
+        
+        if(!read_image_info(input_filename, load_params, job.source_width,
+            job.source_height, job.layout))
+        {
+            return EXIT_FAILURE;
+        }
+        
+        job.output_width = output_width ? output_width : job.source_width;
+        job.output_height = (job.output_width * job.source_height + 
+            job.source_width/2) / job.source_width;
+        
+        if(job.output_height == 0)
+            job.output_height = 1;
+        
+        job.rot = rotation_matrix;
+        job.engine = remap_params.engine;
+        job.streamed = save_format->open != 0;
+        
+        // PNG holds its compressed rows until the file is written
+        job.output_bytes = job.streamed ? 0 : 8;
+        
+        if(!plan_render(memory_plan, job, max_memory))
+        {
+            fprintf(stderr, "[ERROR] Nothing fits in --max-memory %s; the "
+                "smallest estimate is %s (%s)\n", 
+                memory_size_text(max_memory).c_str(),
+                memory_size_text(memory_plan.peak).c_str(),
+                strategy_name(memory_plan.strategy));
+            return EXIT_FAILURE;
+        }
+    }
     
+    bool in_core = memory_plan.strategy == RENDER_IN_CORE;
     
-    // sanity check file arguments and load input image
-    Image<RGBAF> src, dst;
+    // a plain render starts on the top of the output while the rest of
+    // the source is still being decoded (the area engine's table needs
+    // the whole source, and a tiled copy is built from the whole source)
+    bool overlap_decode = plain_render && pyramid_base.size() == 0 &&
+        band_end == 0 && !tiled_source && 
+        remap_params.engine != ENGINE_AREA && in_core;
     
-    if(input_filename.size() == 0)
+    // the alpha of partial panoramas lets remap_full3 skip their empty
+    // parts; with overlap_decode it is mapped as the rows come in
+    CoverageMask coverage;
+    
+    BackgroundLoad background;
+    ImageLoadResult load_result;
+    
+    if(!in_core)
     {
-        fprintf(stderr, "[ERROR] Cannot proceed without input file\n");
-        return EXIT_FAILURE;
+        // loaded below, in the planned way
+        load_result = job.layout;
+        load_result.ok = true;
     }
-    
-    if(!run_test && output_filename.size() == 0)
+    else if(overlap_decode)
     {
-        fprintf(stderr, "[ERROR] No output filename specified\n");
-        return EXIT_FAILURE;
+        background.start(src, input_filename, load_params, &coverage);
+        
+        bool sized = background.progress.wait_sized(load_result);
+        load_result.ok = sized;
+    }
+    else
+    {
+        load_result = load(src, input_filename, load_params);
     }
     
-    ImageLoadResult load_result = load(src, input_filename);
     if(!load_result.ok)
     {
         fprintf(stderr, "[ERROR] Couldn't load input file -- stopping.\n");
         return EXIT_FAILURE;
     }
     
+    // opaque inputs let the engines skip the constant alpha channel
+    if(load_result.spp == 3)
+    {
+        remap_params.channels = 3;
+    }
+    else if(in_core)
+    {
+        if(!overlap_decode && src.height == load_result.full_height)
+            coverage.build(src);
+        
+        remap_params.coverage = &coverage;
+    }
+    
     // if test mode requested, run test and exit early
     if(run_test)
     {
@@ -452,16 +1670,211 @@ int main(int argc, char** argv)
             rot = rotation_matrix;
         }
         
-        double_rotate_test(src, rot, preview_mode);
+        Image<RGBAF> heatmap;
+        Image<RGBAF>* heatmap_ptr = 0;
+        
+        if(heatmap_filename.size() != 0)
+            heatmap_ptr = &heatmap;
+        
+        ImageMetrics metrics = 
+            double_rotate_test(src, rot, preview_mode, remap_params, 
+                heatmap_ptr);
+        
+        if(heatmap_ptr)
+        {
+            save_params.bps = 8;
+            save_params.spp = 3;
+            save_format->save(heatmap, heatmap_filename, save_params);
+        }
+        
+        if(metrics.mean_psnr < min_psnr)
+        {
+            fprintf(stderr, "[ERROR] Mean PSNR %f dB is below the required "
+                "%f dB\n", metrics.mean_psnr, min_psnr);
+            return EXIT_FAILURE;
+        }
+        
+        return 0;
+    }
+    
+    if(autotune_filename.size() != 0)
+    {
+        RemapParams tuned;
+        
+        if(!autotune(tuned, src, min_psnr > 0 ? min_psnr : 40.0, 
+            remap_params))
+        {
+            return EXIT_FAILURE;
+        }
+        
+        if(!save_profile(tuned, autotune_filename))
+        {
+            return EXIT_FAILURE;
+        }
+        
+        printf("Profile written to %s\n", autotune_filename.c_str());
+        return 0;
+    }
+    
+    if(run_scaling)
+    {
+        scaling_test(src, rotation_matrix, preview_mode, remap_params);
+        return 0;
+    }
+    
+    if(run_layout_test)
+    {
+        layout_test(src, rotation_matrix, preview_mode, remap_params);
         return 0;
     }
 
     
+    match_input_samples(save_params, *save_format, load_result);
+    
+    for(size_t i = 0; i < outputs.size(); i++)
+    {
+        match_input_samples(outputs.at(i).params, *outputs.at(i).format,
+            load_result);
+    }
+    
+    // render all perspective views from the one decoded source and exit
+    if(!views.empty())
+    {
+        vector< Image<RGBAF> > view_images(views.size());
+        vector<Viewport> viewports(views.size());
+        
+        for(size_t i = 0; i < views.size(); i++)
+        {
+            const ViewSpec& spec = views.at(i);
+            
+            view_images.at(i).resize(spec.width, spec.height);
+            
+            viewports.at(i).rot = rotZ(deg2rad(spec.yaw)) *
+                                  rotY(deg2rad(spec.pitch)) *
+                                  rotX(deg2rad(spec.roll));
+            viewports.at(i).hfov = deg2rad(spec.hfov);
+            viewports.at(i).onto = &view_images.at(i);
+        }
+        
+        printf("Rendering %lu views from %s...\n", views.size(),
+            input_filename.c_str());
+        
+        remap_rectilinear(viewports, src, rotation_matrix);
+        
+        for(size_t i = 0; i < views.size(); i++)
+        {
+            const ViewSpec& spec = views.at(i);
+            
+            printf("View %lu:      %s (%lux%lu, yaw %g, pitch %g, roll %g, "
+                   "fov %g)\n", i, spec.output_filename.c_str(), 
+                   spec.width, spec.height, spec.yaw, spec.pitch, spec.roll,
+                   spec.hfov);
+            
+            save_format->save(view_images.at(i), spec.output_filename,
+                save_params);
+        }
+        
+        return 0;
+    }
+    
+    // src may only hold some of the rows of the input (--band), or none
+    // of them yet (--max-memory)
+    size_t source_width = in_core ? src.width : job.source_width;
+    
+    if(output_width == 0)
+        output_width = source_width;
+    
+    size_t output_height = (output_width * load_result.full_height + 
+        source_width/2) / source_width;
+    
+    if(output_height == 0)
+        output_height = 1;
+    
+    // render every rotation from the rotations file in one pass and exit
+    if(!rotations.empty())
+    {
+        vector< Image<RGBAF> > outputs(rotations.size());
+        vector<Image<RGBAF>*> output_ptrs(rotations.size());
+        vector<Mat3> rots(rotations.size());
+        
+        for(size_t i = 0; i < rotations.size(); i++)
+        {
+            vector<double> angles = rotations.at(i).angles;
+            
+            while(angles.size() < rotation_sequence.size())
+                angles.push_back(0.0);
+            
+            outputs.at(i).resize(output_width, output_height);
+            output_ptrs.at(i) = &outputs.at(i);
+            rots.at(i) = make_rotation(rotation_sequence, angles);
+        }
+        
+        printf("Rendering %lu rotations of %s at %lux%lu...\n", 
+            rotations.size(), input_filename.c_str(), output_width, 
+            output_height);
+        
+        remap_multi(output_ptrs, src, rots, remap_params);
+        
+        for(size_t i = 0; i < rotations.size(); i++)
+        {
+            printf("Rotation %lu:  %s\n", i, 
+                rotations.at(i).output_filename.c_str());
+            
+            save_format->save(outputs.at(i), 
+                rotations.at(i).output_filename, save_params);
+        }
+        
+        return 0;
+    }
+    
     // print details about request for user sanity checking
     printf("Input:       %s\n", input_filename.c_str());
-    printf("Output:      %s\n", output_filename.c_str());
-    printf("Output type: %s\n", save_format->flag_name.c_str());
-    printf("Size:        %lu %lu\n", src.width, src.height);
+    if(pyramid_base.size() != 0)
+    {
+        printf("Output:      %s (tile pyramid)\n", pyramid_base.c_str());
+    }
+    else if(outputs.size() > 1)
+    {
+        for(size_t i = 0; i < outputs.size(); i++)
+        {
+            printf("Output %lu:    %s (%s", i, 
+                outputs.at(i).filename.c_str(), 
+                outputs.at(i).format->flag_name.c_str());
+            
+            if(outputs.at(i).width)
+                printf(", width %lu", outputs.at(i).width);
+            
+            printf(")\n");
+        }
+    }
+    else
+    {
+        printf("Output:      %s\n", output_filename.c_str());
+        printf("Output type: %s\n", save_format->flag_name.c_str());
+    }
+    
+    printf("Size:        %lu %lu", source_width, load_result.full_height);
+    
+    if(load_result.scale_denom > 1)
+        printf(" (decoded at 1/%u scale)", load_result.scale_denom);
+    
+    printf("\n");
+    
+    if(output_width != source_width || 
+       output_height != load_result.full_height)
+        printf("Output size: %lu %lu\n", output_width, output_height);
+
+    printf("Threads:     %d (%s)\n", thread_count(), 
+        schedule_name(remap_params.schedule));
+    
+    if(remap_params.engine == ENGINE_FAST)
+        printf("Engine:      fast\n");
+    else if(remap_params.engine == ENGINE_AREA)
+        printf("Engine:      area (summed-area table)\n");
+    else
+        printf("Engine:      %s (%dx%d samples, sigma %g)\n", 
+            engine_name(remap_params.engine), remap_params.samples,
+            remap_params.samples, remap_params.sigma);
 
     printf("Order:       ");
 
@@ -507,25 +1920,233 @@ int main(int argc, char** argv)
     printf("\n");
     
     
-    // actually process the image
-    dst.resize(src.width, src.height);
-    
     if(preview_mode)
     {
         printf("Preview mode enabled -- quality may be reduced to produce"
                " results faster\n");
-               
-        remap_fast(dst, src, rotation_matrix);
     }
+    
+    if(max_memory != 0)
+    {
+        printf("Memory:      ");
+        
+        if(memory_plan.strategy == RENDER_BANDS)
+            printf("%lu bands", memory_plan.bands);
+        else
+            printf("%s", strategy_name(memory_plan.strategy));
+        
+        printf(" (about %s of %s)\n", 
+            memory_size_text(memory_plan.peak).c_str(),
+            memory_size_text(max_memory).c_str());
+    }
+    
+    if(pyramid_base.size() != 0)
+    {
+        pyramid_params.quality = save_params.quality;
+        
+        if(!render_pyramid(src, rotation_matrix, remap_params, 
+            output_width, output_height, pyramid_params, pyramid_base))
+        {
+            return EXIT_FAILURE;
+        }
+        
+        return 0;
+    }
+    
+    if(band_end != 0)
+    {
+        SourceWindow window;
+        window.width = src.width;
+        window.height = load_result.full_height;
+        window.first_row = load_result.first_row;
+        window.rows.width = src.width;
+        window.rows.height = src.height;
+        window.rows.values.swap(src.values);
+        
+        printf("Band:        rows %lu to %lu of %lu (source rows %lu to "
+            "%lu)\n", band_first, band_end - 1, output_height, 
+            window.first_row, window.first_row + window.rows.height - 1);
+        
+        remap_params.row_offset = band_first;
+        remap_params.output_height = output_height;
+        save_params.description = shard_description(band_first, 
+            output_height);
+        
+        RowWriter* writer = save_format->open(output_filename, 
+            output_width, band_end - band_first, save_params);
+        
+        if(!writer)
+            return EXIT_FAILURE;
+        
+        bool ok = remap_streamed(*writer, window, rotation_matrix, 
+            remap_params, output_width, band_end - band_first);
+        
+        delete writer;
+        
+        if(!ok)
+        {
+            fprintf(stderr, "[ERROR] Failed to write %s\n", 
+                output_filename.c_str());
+            return EXIT_FAILURE;
+        }
+        
+        return 0;
+    }
+    
+    // the planned strategies only write streamed formats
+    if(!in_core)
+    {
+        RowWriter* writer = save_format->open(output_filename, 
+            output_width, output_height, save_params);
+        
+        if(!writer)
+            return EXIT_FAILURE;
+        
+        bool loaded = true;
+        bool ok = true;
+        
+        if(memory_plan.strategy == RENDER_SAMPLES)
+        {
+            SampleImage samples;
+            loaded = load_samples(samples, input_filename, load_params).ok;
+            
+            if(loaded)
+            {
+                ok = remap_streamed(*writer, samples.pixels, rotation_matrix,
+                    remap_params, output_width, output_height);
+            }
+        }
+        
+        // every band decodes just the source rows it can sample, and the
+        // bands are written one after another to the same file
+        for(size_t k = 0; memory_plan.strategy == RENDER_BANDS &&
+            k < memory_plan.bands && loaded && ok; k++)
+        {
+            size_t first, end;
+            plan_band(output_height, memory_plan.bands, k, first, end);
+            
+            ImageLoadParams band_load = load_params;
+            source_row_range(rotation_matrix, output_height, first, end,
+                band_load.first_row_fraction, band_load.last_row_fraction);
+            
+            SourceWindow window;
+            ImageLoadResult band_result = load(window.rows, input_filename,
+                band_load);
+            
+            loaded = band_result.ok;
+            
+            if(!loaded)
+                break;
+            
+            window.width = window.rows.width;
+            window.height = band_result.full_height;
+            window.first_row = band_result.first_row;
+            
+            RemapParams band_params = remap_params;
+            band_params.row_offset = first;
+            band_params.output_height = output_height;
+            
+            ok = remap_streamed(*writer, window, rotation_matrix, band_params,
+                output_width, end - first);
+        }
+        
+        delete writer;
+        
+        if(!loaded)
+        {
+            fprintf(stderr, "[ERROR] Couldn't load input file -- stopping.\n");
+            return EXIT_FAILURE;
+        }
+        
+        if(!ok)
+        {
+            fprintf(stderr, "[ERROR] Failed to write %s\n", 
+                output_filename.c_str());
+            return EXIT_FAILURE;
+        }
+        
+        return 0;
+    }
+    
+    // the tiled copy replaces the row major source to keep memory flat
+    TiledImage<RGBAF> tiled;
+    
+    if(tiled_source)
+    {
+        tiled.build(src);
+        Image<RGBAF>().values.swap(src.values);
+        
+        // the tiled copy holds the same pixels the mask was made from
+        coverage.image = &tiled;
+        printf("Source:      16x16 tiles\n");
+    }
+    
+    SourceRowGate gate;
+    
+    if(overlap_decode)
+    {
+        gate.progress = &background.progress;
+        gate.rot = rotation_matrix;
+        gate.output_width = output_width;
+        gate.output_height = output_height;
+        gate.source_height = src.height;
+        
+        remap_params.schedule.gate = &gate;
+        printf("Source:      remapped while decoding\n");
+    }
+    
+    // formats that can be written incrementally are encoded band by band
+    // while the rest of the image is still being remapped
+    if(save_format->open && outputs.size() < 2)
+    {
+        RowWriter* writer = save_format->open(output_filename, 
+            output_width, output_height, save_params);
+        
+        if(!writer)
+            return EXIT_FAILURE;
+        
+        bool ok = tiled_source ?
+            remap_streamed(*writer, tiled, rotation_matrix, remap_params, 
+                output_width, output_height) :
+            remap_streamed(*writer, src, rotation_matrix, remap_params, 
+                output_width, output_height);
+        
+        delete writer;
+        
+        if(overlap_decode && !background.finish())
+        {
+            fprintf(stderr, "[ERROR] Couldn't load input file -- stopping.\n");
+            return EXIT_FAILURE;
+        }
+        
+        if(!ok)
+        {
+            fprintf(stderr, "[ERROR] Failed to write %s\n", 
+                output_filename.c_str());
+            return EXIT_FAILURE;
+        }
+        
+        return 0;
+    }
+    
+    // actually process the image
+    dst.resize(output_width, output_height);
+    
+    if(tiled_source)
+        remap(dst, tiled, rotation_matrix, remap_params);
     else
+        remap(dst, src, rotation_matrix, remap_params);
+    
+    if(overlap_decode && !background.finish())
     {
-        remap_full3(dst, src, rotation_matrix);
+        fprintf(stderr, "[ERROR] Couldn't load input file -- stopping.\n");
+        return EXIT_FAILURE;
     }
     
-    if(save_format->flag_name == "TIFF")
+    if(outputs.size() > 1)
     {
-        save_params.bps = load_result.bps;
-        save_params.spp = load_result.spp;
+        save_outputs(dst, outputs, source_width, load_result.full_height);
+        return 0;
     }
     
     save_format->save(dst, output_filename, save_params);
@@ -0,0 +1,211 @@
+#include "memory_plan.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+using namespace std;
+
+// bytes of one RGBAF pixel, as held by Image<RGBAF> and the area table
+static const size_t PIXEL_BYTES = sizeof(RGBAF);
+
+// output rows per band of remap_streamed (its default band_rows)
+static const size_t STREAM_ROWS = 64;
+
+// code, libraries, thread stacks, decoder state and lookup tables
+static const size_t OVERHEAD = 32 << 20;
+
+// more bands than this decode the source too many times to be useful
+static const size_t MAX_BANDS = 256;
+
+bool parse_memory_size(size_t& bytes, const std::string& text)
+{
+    const char* begin = text.c_str();
+    char* end = 0;
+    double value = strtod(begin, &end);
+    
+    if(end == begin || !(value > 0.0))
+        return false;
+    
+    double scale = 1.0;
+    
+    switch(toupper(*end))
+    {
+        case 'T':
+            scale *= 1024;
+            // fall through
+        case 'G':
+            scale *= 1024;
+            // fall through
+        case 'M':
+            scale *= 1024;
+            // fall through
+        case 'K':
+            scale *= 1024;
+            end++;
+            break;
+        
+        case '\0':
+            break;
+        
+        default:
+            return false;
+    }
+    
+    if(*end != '\0')
+        return false;
+    
+    bytes = (size_t)(value * scale);
+    return bytes > 0;
+}
+
+std::string memory_size_text(size_t bytes)
+{
+    const char* units[] = {"bytes", "KiB", "MiB", "GiB", "TiB"};
+    double value = bytes;
+    int unit = 0;
+    
+    while(value >= 1024 && unit < 4)
+    {
+        value /= 1024;
+        unit++;
+    }
+    
+    char text[64];
+    snprintf(text, sizeof(text), unit ? "%.1f %s" : "%.0f %s", value,
+        units[unit]);
+    
+    return text;
+}
+
+const char* strategy_name(RenderStrategy strategy)
+{
+    switch(strategy)
+    {
+        case RENDER_IN_CORE:
+            return "in-core";
+        case RENDER_SAMPLES:
+            return "file samples";
+        case RENDER_BANDS:
+            return "bands";
+    }
+    
+    return "unknown";
+}
+
+void plan_band(size_t output_height, size_t bands, size_t k, size_t& first,
+    size_t& end)
+{
+    first = output_height * k / bands;
+    end = output_height * (k+1) / bands;
+}
+
+bool estimate_peak(size_t& peak, const RenderJob& job,
+    RenderStrategy strategy, size_t bands)
+{
+    const size_t source_pixels = job.source_width * job.source_height;
+    
+    // two bands of output rows are in flight, or the whole output is held
+    size_t output = job.streamed ?
+        2 * min(STREAM_ROWS, job.output_height) * job.output_width *
+            PIXEL_BYTES :
+        job.output_width * job.output_height *
+            (PIXEL_BYTES + job.output_bytes);
+    
+    // the area engine's summed-area table covers the whole source
+    size_t table = job.engine == ENGINE_AREA ?
+        job.source_width * (job.source_height + 1) * PIXEL_BYTES : 0;
+    
+    switch(strategy)
+    {
+        case RENDER_IN_CORE:
+            peak = source_pixels * PIXEL_BYTES + output + table;
+            break;
+        
+        case RENDER_SAMPLES:
+        {
+            // only streamed outputs are rendered from a sample buffer
+            if(!job.streamed)
+                return false;
+            
+            size_t bytes = job.layout.bps / 8 * job.layout.spp;
+            peak = source_pixels * bytes + output + table;
+            break;
+        }
+        
+        case RENDER_BANDS:
+        {
+            // each band goes to the same writer; the area table would
+            // still cover every source row
+            if(!job.streamed || job.engine == ENGINE_AREA || bands < 1 ||
+               bands > job.output_height)
+            {
+                return false;
+            }
+            
+            // the tallest source window any band decodes, with the same
+            // margins as the loaders
+            size_t rows = 0;
+            
+            for(size_t k = 0; k < bands; k++)
+            {
+                size_t first, end;
+                plan_band(job.output_height, bands, k, first, end);
+                
+                ImageLoadParams window;
+                source_row_range(job.rot, job.output_height, first, end,
+                    window.first_row_fraction, window.last_row_fraction);
+                
+                size_t top, bottom;
+                window.row_window(job.source_height, top, bottom);
+                
+                rows = max(rows, bottom - top + 1);
+            }
+            
+            peak = rows * job.source_width * PIXEL_BYTES + output;
+            break;
+        }
+    }
+    
+    peak += OVERHEAD;
+    return true;
+}
+
+bool plan_render(MemoryPlan& plan, const RenderJob& job, size_t budget)
+{
+    MemoryPlan smallest;
+    bool any = false;
+    
+    // whole source strategies first, then 2, 3, ... bands (each band
+    // decodes the source rows above its window again for JPEG and PNG
+    // inputs, so fewer are faster)
+    size_t last_bands = min(MAX_BANDS, job.output_height);
+    
+    for(size_t i = 0; i <= last_bands || i < 2; i++)
+    {
+        MemoryPlan candidate;
+        candidate.strategy = i == 0 ? RENDER_IN_CORE :
+                             i == 1 ? RENDER_SAMPLES : RENDER_BANDS;
+        candidate.bands = i < 2 ? 1 : i;
+        
+        if(!estimate_peak(candidate.peak, job, candidate.strategy,
+            candidate.bands))
+        {
+            continue;
+        }
+        
+        if(candidate.peak <= budget)
+        {
+            plan = candidate;
+            return true;
+        }
+        
+        if(!any || candidate.peak < smallest.peak)
+            smallest = candidate;
+        
+        any = true;
+    }
+    
+    plan = smallest;
+    return false;
+}
@@ -0,0 +1,238 @@
+#include "metrics.h"
+
+#include <cstdio>
+#include <cmath>
+using namespace std;
+
+// SSIM is evaluated on non-overlapping windows of this size so that every
+// pixel is visited exactly once
+static const size_t WINDOW = 8;
+
+static inline double quantize8(double v)
+{
+    if(v < 0)
+        v = 0;
+    if(v > 1)
+        v = 1;
+    
+    return (unsigned char)(0xFF * v);
+}
+
+static inline double ssim_window(double n, double sa, double sb, 
+    double saa, double sbb, double sab)
+{
+    // constants from Wang et al. for a dynamic range of 1.0
+    const double C1 = 0.01 * 0.01;
+    const double C2 = 0.03 * 0.03;
+    
+    double mu_a = sa / n;
+    double mu_b = sb / n;
+    double var_a = saa / n - mu_a * mu_a;
+    double var_b = sbb / n - mu_b * mu_b;
+    double cov   = sab / n - mu_a * mu_b;
+    
+    return ((2*mu_a*mu_b + C1) * (2*cov + C2)) /
+           ((mu_a*mu_a + mu_b*mu_b + C1) * (var_a + var_b + C2));
+}
+
+// heat ramp: black -> red -> yellow -> white
+static inline RGBAF heat_color(double t)
+{
+    double r = 3*t;
+    double g = 3*t - 1;
+    double b = 3*t - 2;
+    
+    return RGBAF(r < 0 ? 0 : (r > 1 ? 1 : r),
+                 g < 0 ? 0 : (g > 1 ? 1 : g),
+                 b < 0 ? 0 : (b > 1 ? 1 : b));
+}
+
+static inline void set_channel(RGBAF& v, int c, double value)
+{
+    switch(c)
+    {
+        case 0: v.r = value; break;
+        case 1: v.g = value; break;
+        case 2: v.b = value; break;
+    }
+}
+
+// accumulators for one channel; one copy per thread
+struct ChannelStats
+{
+    double sad, ssd, max_error;
+    double sad8, ssd8;
+    double ssim_sum;    // sum of window ssim weighted by window pixels
+    
+    ChannelStats() : sad(0), ssd(0), max_error(0), sad8(0), ssd8(0),
+        ssim_sum(0) {}
+};
+
+ImageMetrics compare_images(const Image<RGBAF>& ref, const Image<RGBAF>& test,
+    Image<RGBAF>* heatmap, double heat_range)
+{
+    ImageMetrics result;
+    
+    if(ref.width != test.width || ref.height != test.height)
+    {
+        fprintf(stderr, "[ERROR] compare_images: size mismatch "
+            "(%lu x %lu vs %lu x %lu)\n", ref.width, ref.height,
+            test.width, test.height);
+        return result;
+    }
+    
+    if(heatmap)
+        heatmap->resize(ref.width, ref.height);
+    
+    const size_t W = ref.width;
+    const size_t H = ref.height;
+    const size_t windows_x = (W + WINDOW - 1) / WINDOW;
+    const size_t windows_y = (H + WINDOW - 1) / WINDOW;
+    
+    ChannelStats total[3];
+    
+    #pragma omp parallel
+    {
+        ChannelStats local[3];
+        
+        #pragma omp for schedule(dynamic, 1) nowait
+        for(long wy = 0; wy < (long)windows_y; wy++)
+        for(size_t wx = 0; wx < windows_x; wx++)
+        {
+            size_t x0 = wx * WINDOW;
+            size_t y0 = wy * WINDOW;
+            size_t x1 = x0 + WINDOW < W ? x0 + WINDOW : W;
+            size_t y1 = y0 + WINDOW < H ? y0 + WINDOW : H;
+            
+            for(int c = 0; c < 3; c++)
+            {
+                double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+                double sad = 0, ssd = 0, max_error = local[c].max_error;
+                double sad8 = 0, ssd8 = 0;
+                
+                for(size_t y = y0; y < y1; y++)
+                {
+                    // channels are interleaved so c selects a strided
+                    // lane of the row; the row loop is SIMD reduced
+                    const double* pa = &ref.values[W*y].r + c;
+                    const double* pb = &test.values[W*y].r + c;
+                    
+                    #pragma omp simd reduction(+:sa,sb,saa,sbb,sab,sad,ssd,sad8,ssd8) reduction(max:max_error)
+                    for(size_t x = x0; x < x1; x++)
+                    {
+                        double a = pa[4*x];
+                        double b = pb[4*x];
+                        double d = a - b;
+                        double ad = fabs(d);
+                        double d8 = quantize8(a) - quantize8(b);
+                        
+                        sa  += a;
+                        sb  += b;
+                        saa += a*a;
+                        sbb += b*b;
+                        sab += a*b;
+                        
+                        sad += ad;
+                        ssd += d*d;
+                        max_error = ad > max_error ? ad : max_error;
+                        
+                        sad8 += fabs(d8);
+                        ssd8 += d8*d8;
+                    }
+                }
+                
+                double n = (double)(x1 - x0) * (y1 - y0);
+                
+                local[c].sad  += sad;
+                local[c].ssd  += ssd;
+                local[c].sad8 += sad8;
+                local[c].ssd8 += ssd8;
+                local[c].max_error = max_error;
+                local[c].ssim_sum += n * ssim_window(n, sa, sb, saa, sbb, sab);
+            }
+            
+            if(heatmap)
+            {
+                for(size_t y = y0; y < y1; y++)
+                for(size_t x = x0; x < x1; x++)
+                {
+                    const RGBAF& a = ref.values[W*y + x];
+                    const RGBAF& b = test.values[W*y + x];
+                    
+                    double e = fabs(a.r - b.r);
+                    e = fmax(e, fabs(a.g - b.g));
+                    e = fmax(e, fabs(a.b - b.b));
+                    
+                    heatmap->values[W*y + x] = heat_color(e / heat_range);
+                }
+            }
+        }
+        
+        #pragma omp critical
+        {
+            for(int c = 0; c < 3; c++)
+            {
+                total[c].sad  += local[c].sad;
+                total[c].ssd  += local[c].ssd;
+                total[c].sad8 += local[c].sad8;
+                total[c].ssd8 += local[c].ssd8;
+                total[c].ssim_sum += local[c].ssim_sum;
+                total[c].max_error = 
+                    fmax(total[c].max_error, local[c].max_error);
+            }
+        }
+    }
+    
+    double pixels = (double)W * H;
+    
+    for(int c = 0; c < 3; c++)
+    {
+        double mse = total[c].ssd / pixels;
+        double psnr = mse > 0 ? 10.0 * log10(1.0 / mse) : INFINITY;
+        double ssim = total[c].ssim_sum / pixels;
+        
+        set_channel(result.sad, c, total[c].sad);
+        set_channel(result.mad, c, total[c].sad / pixels);
+        set_channel(result.ssd, c, total[c].ssd);
+        set_channel(result.max_error, c, total[c].max_error);
+        set_channel(result.psnr, c, psnr);
+        set_channel(result.ssim, c, ssim);
+        set_channel(result.sad8, c, total[c].sad8);
+        set_channel(result.mad8, c, total[c].sad8 / pixels);
+        set_channel(result.ssd8, c, total[c].ssd8);
+        
+        result.mean_psnr += psnr / 3.0;
+        result.mean_ssim += ssim / 3.0;
+    }
+    
+    return result;
+}
+
+static void print_channels(const char* title, const RGBAF& v)
+{
+    printf("%s:\n"
+           "Red:\t%f\n"
+           "Green:\t%f\n"
+           "Blue:\t%f\n",
+           title, v.r, v.g, v.b);
+    printf("\n");
+}
+
+void print_metrics(const ImageMetrics& m)
+{
+    print_channels("Sum of absolute differences (float)", m.sad);
+    print_channels("Mean absolute differences (float)", m.mad);
+    print_channels("Sum of squared differences (float)", m.ssd);
+    print_channels("Max absolute difference (float)", m.max_error);
+    print_channels("PSNR in dB (float)", m.psnr);
+    print_channels("SSIM (float, 8x8 windows)", m.ssim);
+    
+    printf("\n");
+    
+    print_channels("Sum of absolute differences (RGB8)", m.sad8);
+    print_channels("Mean absolute differences (RGB8)", m.mad8);
+    print_channels("Sum of squared differences (RGB8)", m.ssd8);
+    
+    printf("Mean PSNR:\t%f dB\n", m.mean_psnr);
+    printf("Mean SSIM:\t%f\n", m.mean_ssim);
+}
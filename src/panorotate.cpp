@@ -0,0 +1,237 @@
+#include "panorotate.h"
+#include "custom_math.h"
+#include "pixel_buffer.h"
+#include "remap.h"
+
+#include <omp.h>
+#include <cmath>
+#include <new>
+using namespace std;
+
+// each subsample adds a row and a column of directions to the engine's
+// lookup table; more than this only costs memory
+static const int MAX_SAMPLES = 31;
+
+static size_t sample_size(pr_format format)
+{
+    switch(format)
+    {
+        case PR_FORMAT_U8:
+            return 1;
+        case PR_FORMAT_U16:
+        case PR_FORMAT_F16:
+            return 2;
+        case PR_FORMAT_F32:
+            return 4;
+    }
+    
+    return 0;
+}
+
+// describes a pr_image as per channel pointers and strides
+static pr_status make_buffer(PixelBuffer& out, const pr_image* image)
+{
+    if(!image || image->width == 0 || image->height == 0)
+        return PR_ERROR_ARGUMENT;
+    
+    size_t bytes = sample_size(image->format);
+    
+    if(bytes == 0 || (image->channels != 3 && image->channels != 4))
+        return PR_ERROR_FORMAT;
+    
+    out.width = image->width;
+    out.height = image->height;
+    out.channels = image->channels;
+    
+    switch(image->format)
+    {
+        case PR_FORMAT_U8:
+            out.format = PIXEL_U8;
+            break;
+        case PR_FORMAT_U16:
+            out.format = PIXEL_U16;
+            break;
+        case PR_FORMAT_F16:
+            out.format = PIXEL_F16;
+            break;
+        case PR_FORMAT_F32:
+            out.format = PIXEL_F32;
+            break;
+    }
+    
+    if(image->layout == PR_LAYOUT_INTERLEAVED)
+    {
+        if(!image->data[0])
+            return PR_ERROR_ARGUMENT;
+        
+        out.pixel_stride = bytes * image->channels;
+        
+        for(uint32_t c = 0; c < image->channels; c++)
+            out.planes[c] = (unsigned char*)image->data[0] + bytes*c;
+    }
+    else if(image->layout == PR_LAYOUT_PLANAR)
+    {
+        out.pixel_stride = bytes;
+        
+        for(uint32_t c = 0; c < image->channels; c++)
+        {
+            if(!image->data[c])
+                return PR_ERROR_ARGUMENT;
+            
+            out.planes[c] = (unsigned char*)image->data[c];
+        }
+    }
+    else
+    {
+        return PR_ERROR_FORMAT;
+    }
+    
+    // shorter rows would overlap the next ones
+    size_t packed = out.pixel_stride * out.width;
+    
+    if(image->row_stride != 0 && image->row_stride < packed)
+        return PR_ERROR_ARGUMENT;
+    
+    out.row_stride = image->row_stride ? image->row_stride : packed;
+    
+    return PR_OK;
+}
+
+// true if any byte of any channel of a can also be reached through b;
+// a_bytes and b_bytes are the sample sizes
+static bool overlaps(const PixelBuffer& a, size_t a_bytes, 
+    const PixelBuffer& b, size_t b_bytes)
+{
+    for(int i = 0; i < a.channels; i++)
+    for(int j = 0; j < b.channels; j++)
+    {
+        const unsigned char* a0 = a.sample(0, 0, i);
+        const unsigned char* a1 = a.sample(a.width-1, a.height-1, i) + a_bytes;
+        const unsigned char* b0 = b.sample(0, 0, j);
+        const unsigned char* b1 = b.sample(b.width-1, b.height-1, j) + b_bytes;
+        
+        if(a0 < b1 && b0 < a1)
+            return true;
+    }
+    
+    return false;
+}
+
+void pr_default_options(pr_options* options)
+{
+    RemapParams defaults;
+    
+    options->engine = PR_ENGINE_FULL3;
+    options->samples = defaults.samples;
+    options->sigma = defaults.sigma;
+    options->threads = 0;
+}
+
+void pr_rotation(double matrix[9], double roll, double pitch, double yaw)
+{
+    Mat3 m = rotX(deg2rad(roll)) * rotY(deg2rad(pitch)) * rotZ(deg2rad(yaw));
+    
+    for(int i = 0; i < 9; i++)
+        matrix[i] = m[i];
+}
+
+pr_status pr_rotate(const pr_image* src, const pr_image* dst,
+    const double matrix[9], const pr_options* options)
+{
+    if(!matrix)
+        return PR_ERROR_ARGUMENT;
+    
+    PixelBuffer from, onto;
+    pr_status status;
+    
+    if((status = make_buffer(from, src)) != PR_OK)
+        return status;
+    
+    if((status = make_buffer(onto, dst)) != PR_OK)
+        return status;
+    
+    if(overlaps(from, sample_size(src->format), 
+                onto, sample_size(dst->format)))
+        return PR_ERROR_OVERLAP;
+    
+    pr_options defaults;
+    pr_default_options(&defaults);
+    
+    if(!options)
+        options = &defaults;
+    
+    if(options->samples < 1 || options->samples > MAX_SAMPLES ||
+       options->samples % 2 == 0 || 
+       !(options->sigma > 0) || !isfinite(options->sigma) ||
+       options->threads < 0)
+    {
+        return PR_ERROR_ARGUMENT;
+    }
+    
+    RemapParams params;
+    switch(options->engine)
+    {
+        case PR_ENGINE_FULL3:
+            params.engine = ENGINE_FULL3;
+            break;
+        case PR_ENGINE_FAST:
+            params.engine = ENGINE_FAST;
+            break;
+        case PR_ENGINE_AREA:
+            params.engine = ENGINE_AREA;
+            break;
+        default:
+            return PR_ERROR_ARGUMENT;
+    }
+
+    params.samples = options->samples;
+    params.sigma = options->sigma;
+    
+    Mat3 rot;
+    
+    for(int i = 0; i < 9; i++)
+        rot[i] = matrix[i];
+    
+    // the thread count is a per calling thread setting in OpenMP, so this
+    // doesn't affect rotations running concurrently on other threads
+    int saved_threads = omp_get_max_threads();
+    
+    if(options->threads > 0)
+        omp_set_num_threads(options->threads);
+    
+    // exceptions must not cross into C callers
+    status = PR_OK;
+    
+    try
+    {
+        remap(onto, from, rot, params);
+    }
+    catch(const std::bad_alloc&)
+    {
+        status = PR_ERROR_MEMORY;
+    }
+    
+    omp_set_num_threads(saved_threads);
+    
+    return status;
+}
+
+const char* pr_status_string(pr_status status)
+{
+    switch(status)
+    {
+        case PR_OK:
+            return "ok";
+        case PR_ERROR_ARGUMENT:
+            return "missing image data, zero sized image, short row stride "
+                "or invalid option";
+        case PR_ERROR_FORMAT:
+            return "unsupported pixel format, layout or channel count";
+        case PR_ERROR_OVERLAP:
+            return "source and destination pixels overlap";
+        case PR_ERROR_MEMORY:
+            return "out of memory";
+    }
+    
+    return "unknown error";
+}
@@ -0,0 +1,197 @@
+#include "parallel.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sched.h>
+#include <omp.h>
+using namespace std;
+
+bool parse_schedule(TileSchedule& out, const std::string& text)
+{
+    if(text == "static")
+    {
+        out.kind = TileSchedule::STATIC_ROWS;
+        return true;
+    }
+    
+    if(text.compare(0, 7, "dynamic") != 0)
+        return false;
+    
+    out.kind = TileSchedule::DYNAMIC_TILES;
+    
+    if(text.size() == 7)
+        return true;
+    
+    unsigned long w = 0, h = 0;
+    char extra = 0;
+    
+    if(sscanf(text.c_str() + 7, ":%lux%lu%c", &w, &h, &extra) != 2 ||
+       w == 0 || h == 0)
+    {
+        return false;
+    }
+    
+    out.tile_width = w;
+    out.tile_height = h;
+    return true;
+}
+
+const char* schedule_name(const TileSchedule& sched)
+{
+    switch(sched.kind)
+    {
+        case TileSchedule::STATIC_ROWS:
+            return "static rows";
+        case TileSchedule::DYNAMIC_TILES:
+            return "dynamic tiles";
+    }
+    
+    return "unknown";
+}
+
+void set_thread_count(int threads)
+{
+    if(threads > 0)
+        omp_set_num_threads(threads);
+}
+
+int thread_count()
+{
+    return omp_get_max_threads();
+}
+
+// cpus this process is allowed to run on (e.g. restricted by taskset or
+// a batch scheduler's cgroup)
+static vector<int> allowed_cpus()
+{
+    vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    
+    if(sched_getaffinity(0, sizeof(set), &set) != 0)
+        return cpus;
+    
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+    
+    return cpus;
+}
+
+bool parse_affinity(std::vector<int>& cpus, const std::string& text)
+{
+    cpus.clear();
+    
+    if(text == "compact" || text == "spread")
+    {
+        vector<int> allowed = allowed_cpus();
+        int threads = thread_count();
+        
+        if(allowed.empty())
+            return false;
+        
+        for(int i = 0; i < threads; i++)
+        {
+            if(text == "compact")
+            {
+                cpus.push_back(allowed.at(i % allowed.size()));
+            }
+            else
+            {
+                size_t slot = (size_t)i * allowed.size() / threads;
+                cpus.push_back(allowed.at(slot % allowed.size()));
+            }
+        }
+        
+        return true;
+    }
+    
+    // comma separated list of cpus and ranges, e.g. 0-7,16,18
+    const char* p = text.c_str();
+    
+    while(*p)
+    {
+        char* end = 0;
+        long first = strtol(p, &end, 10);
+        
+        if(end == p || first < 0 || first >= CPU_SETSIZE)
+            return false;
+        
+        long last = first;
+        p = end;
+        
+        if(*p == '-')
+        {
+            p++;
+            last = strtol(p, &end, 10);
+            
+            if(end == p || last < first || last >= CPU_SETSIZE)
+                return false;
+            
+            p = end;
+        }
+        
+        for(long cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+        
+        if(*p == ',')
+            p++;
+        else if(*p)
+            return false;
+    }
+    
+    return !cpus.empty();
+}
+
+// every cpu of the last pin_threads list, for unpin_thread
+static cpu_set_t pinned_cpus;
+static bool threads_pinned = false;
+
+bool pin_threads(const std::vector<int>& cpus)
+{
+    if(cpus.empty())
+        return false;
+    
+    CPU_ZERO(&pinned_cpus);
+    
+    for(size_t i = 0; i < cpus.size(); i++)
+        CPU_SET(cpus.at(i), &pinned_cpus);
+    
+    threads_pinned = true;
+    
+    bool ok = true;
+    
+    // libgomp keeps its worker threads alive between parallel regions, so
+    // pinning them once here carries over to the remap loops
+    #pragma omp parallel
+    {
+        int cpu = cpus.at(omp_get_thread_num() % cpus.size());
+        
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        
+        if(sched_setaffinity(0, sizeof(set), &set) != 0)
+        {
+            #pragma omp critical
+            {
+                fprintf(stderr, "[WARNING] Could not pin thread %d to "
+                    "cpu %d: %s\n", omp_get_thread_num(), cpu, 
+                    strerror(errno));
+                ok = false;
+            }
+        }
+    }
+    
+    return ok;
+}
+
+void unpin_thread()
+{
+    if(threads_pinned)
+        sched_setaffinity(0, sizeof(pinned_cpus), &pinned_cpus);
+}
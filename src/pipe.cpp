@@ -0,0 +1,151 @@
+#include "pipe.h"
+#include "pixel_buffer.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+bool parse_pipe_format(PipeFormat& out, const std::string& name)
+{
+    if(name == "rgb24")
+        out = PIPE_RGB24;
+    else if(name == "rgb48" || name == "rgb48le")
+        out = PIPE_RGB48;
+    else if(name == "rgba")
+        out = PIPE_RGBA;
+    else
+        return false;
+    
+    return true;
+}
+
+// describes one interleaved raw frame held in data
+static PixelBuffer frame_buffer(vector<unsigned char>& data, 
+    PipeFormat format, size_t width, size_t height)
+{
+    PixelBuffer buffer;
+    size_t bytes = format == PIPE_RGB48 ? 2 : 1;
+    
+    buffer.width = width;
+    buffer.height = height;
+    buffer.channels = format == PIPE_RGBA ? 4 : 3;
+    buffer.format = format == PIPE_RGB48 ? PIXEL_U16 : PIXEL_U8;
+    buffer.pixel_stride = bytes * buffer.channels;
+    buffer.row_stride = buffer.pixel_stride * width;
+    
+    data.resize(buffer.row_stride * height);
+    
+    for(int c = 0; c < buffer.channels; c++)
+        buffer.planes[c] = &data[0] + bytes*c;
+    
+    return buffer;
+}
+
+// rgb48 frames are little endian; the engines read host order samples,
+// so on big endian hosts the bytes of every sample are swapped in place
+static void swap_frame_bytes(vector<unsigned char>& data, PipeFormat format)
+{
+    const uint16_t one = 1;
+    
+    if(format != PIPE_RGB48 || *(const unsigned char*)&one == 1)
+        return;
+    
+    for(size_t i = 0; i + 1 < data.size(); i += 2)
+        swap(data[i], data[i+1]);
+}
+
+bool run_pipe(const PipeParams& params, Mat3 rot, 
+    const RemapParams& remap_params)
+{
+    // every frame has the same size and rotation, so the direction tables
+    // (and the area engine's table storage) are made once
+    RemapCache cache;
+    RemapParams frame_params = remap_params;
+    frame_params.cache = &cache;
+    
+    // two of each buffer: frame k is remapped from input[k % 2] into
+    // output[k % 2] while frame k+1 is read and frame k-1 is written
+    vector<unsigned char> input_data[2], output_data[2];
+    PixelBuffer input[2], output[2];
+    
+    for(int i = 0; i < 2; i++)
+    {
+        input[i] = frame_buffer(input_data[i], params.format, 
+            params.width, params.height);
+        output[i] = frame_buffer(output_data[i], params.format,
+            params.output_width, params.output_height);
+    }
+    
+    const size_t input_size = input_data[0].size();
+    const size_t output_size = output_data[0].size();
+    
+    size_t got = fread(&input_data[0][0], 1, input_size, stdin);
+    swap_frame_bytes(input_data[0], params.format);
+    size_t frames = 0;
+    bool ok = true;
+    
+    thread reader, writer;
+    
+    while(got == input_size)
+    {
+        const int k = frames % 2;
+        size_t next_got = 0;
+        
+        reader = thread([&]()
+        {
+            unpin_thread();
+            next_got = fread(&input_data[1-k][0], 1, input_size, stdin);
+            swap_frame_bytes(input_data[1-k], params.format);
+        });
+        
+        remap(output[k], input[k], rot, frame_params);
+        
+        if(writer.joinable())
+            writer.join();
+        
+        if(!ok)
+        {
+            reader.join();
+            break;
+        }
+        
+        writer = thread([&, k]()
+        {
+            unpin_thread();
+            swap_frame_bytes(output_data[k], params.format);
+            
+            if(fwrite(&output_data[k][0], 1, output_size, stdout) != 
+               output_size)
+            {
+                ok = false;
+            }
+        });
+        
+        reader.join();
+        got = next_got;
+        frames++;
+    }
+    
+    if(writer.joinable())
+        writer.join();
+    
+    fflush(stdout);
+    
+    if(!ok)
+    {
+        fprintf(stderr, "[ERROR] Failed to write to stdout\n");
+        return false;
+    }
+    
+    if(got != 0)
+    {
+        fprintf(stderr, "[WARNING] Ignoring %lu trailing bytes of a partial "
+            "frame\n", got);
+    }
+    
+    fprintf(stderr, "Rotated %lu frames\n", frames);
+    return true;
+}
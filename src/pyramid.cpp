@@ -0,0 +1,295 @@
+#include "pyramid.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+using namespace std;
+
+bool parse_pyramid_layout(PyramidLayout& out, const std::string& name)
+{
+    if(name == "dz" || name == "deepzoom")
+        out = PYRAMID_DEEPZOOM;
+    else if(name == "xyz")
+        out = PYRAMID_XYZ;
+    else
+        return false;
+    
+    return true;
+}
+
+static bool make_dir(const string& path)
+{
+    if(mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "[ERROR] Failed to create directory %s: %s\n",
+            path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    return true;
+}
+
+// one level of the pyramid with the rows not yet cut into tiles
+struct PyramidLevel
+{
+    size_t width;
+    size_t height;
+    int number;         // level/zoom number used in the tile paths
+    
+    Image<RGBAF> band;  // rows band_y .. band_y + rows - 1 of this level
+    size_t band_y;
+    size_t rows;
+};
+
+// receives the full resolution level a row of tiles at a time
+struct PyramidWriter : public RowWriter
+{
+    PyramidParams params;
+    string base;
+    vector<PyramidLevel> levels;    // finest first
+    bool failed;                    // a tile could not be written
+    
+    PyramidWriter() : failed(false) {}
+    
+    string tile_path(const PyramidLevel& level, size_t col, size_t row)
+    {
+        char name[64];
+        
+        if(params.layout == PYRAMID_DEEPZOOM)
+        {
+            snprintf(name, sizeof(name), "/%d/%lu_%lu.jpg", 
+                level.number, col, row);
+            return base + "_files" + name;
+        }
+        
+        snprintf(name, sizeof(name), "/%d/%lu/%lu.jpg", 
+            level.number, col, row);
+        return base + name;
+    }
+    
+    bool make_dirs()
+    {
+        if(params.layout == PYRAMID_DEEPZOOM)
+        {
+            if(!make_dir(base + "_files"))
+                return false;
+        }
+        else if(!make_dir(base))
+        {
+            return false;
+        }
+        
+        for(size_t i = 0; i < levels.size(); i++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "/%d", levels[i].number);
+            
+            string dir = base + (params.layout == PYRAMID_DEEPZOOM ? 
+                "_files" : "") + name;
+            
+            if(!make_dir(dir))
+                return false;
+            
+            if(params.layout != PYRAMID_XYZ)
+                continue;
+            
+            size_t cols = (levels[i].width + params.tile_size - 1) / 
+                params.tile_size;
+            
+            for(size_t col = 0; col < cols; col++)
+            {
+                snprintf(name, sizeof(name), "/%lu", col);
+                
+                if(!make_dir(dir + name))
+                    return false;
+            }
+        }
+        
+        return true;
+    }
+    
+    // encodes the pending rows of level i as one row of tiles and passes a
+    // 2x downsampled copy of them on to the next coarser level
+    void flush(size_t i)
+    {
+        PyramidLevel& level = levels[i];
+        const size_t T = params.tile_size;
+        const size_t tile_row = level.band_y / T;
+        const long cols = (level.width + T - 1) / T;
+        
+        ImageSaveParams save_params;
+        save_params.quality = params.quality;
+        
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(long col = 0; col < cols; col++)
+        {
+            size_t x0 = col * T;
+            size_t w = x0 + T < level.width ? T : level.width - x0;
+            
+            Image<RGBAF> tile(w, level.rows);
+            
+            for(size_t y = 0; y < level.rows; y++)
+            for(size_t x = 0; x < w; x++)
+            {
+                tile.values[w*y + x] = 
+                    level.band.values[level.width*y + x0 + x];
+            }
+            
+            if(!write_jpeg(tile, tile_path(level, col, tile_row), 
+                save_params))
+            {
+                #pragma omp critical
+                failed = true;
+            }
+        }
+        
+        if(i + 1 < levels.size())
+        {
+            PyramidLevel& next = levels[i+1];
+            size_t half_rows = (level.rows + 1) / 2;
+            
+            Image<RGBAF> half(next.width, half_rows);
+            
+            #pragma omp parallel for
+            for(size_t y = 0; y < half_rows; y++)
+            for(size_t x = 0; x < next.width; x++)
+            {
+                // average the (up to) 2x2 finer pixels that exist
+                RGBAF sum;
+                double count = 0;
+                
+                for(size_t dy = 0; dy < 2; dy++)
+                for(size_t dx = 0; dx < 2; dx++)
+                {
+                    size_t sx = 2*x + dx;
+                    size_t sy = 2*y + dy;
+                    
+                    if(sx < level.width && sy < level.rows)
+                    {
+                        sum += level.band.values[level.width*sy + sx];
+                        count += 1;
+                    }
+                }
+                
+                half.values[next.width*y + x] = (1.0 / count) * sum;
+            }
+            
+            push(i+1, half);
+        }
+        
+        level.band_y += level.rows;
+        level.rows = 0;
+    }
+    
+    bool write_rows(const Image<RGBAF>& band)
+    {
+        push(0, band);
+        return !failed;
+    }
+    
+    // appends rows to level i, flushing every full row of tiles
+    void push(size_t i, const Image<RGBAF>& rows)
+    {
+        PyramidLevel& level = levels[i];
+        
+        for(size_t y = 0; y < rows.height; y++)
+        {
+            for(size_t x = 0; x < level.width; x++)
+            {
+                level.band.values[level.width*level.rows + x] = 
+                    rows.values[rows.width*y + x];
+            }
+            
+            level.rows++;
+            
+            if(level.rows == params.tile_size || 
+               level.band_y + level.rows == level.height)
+            {
+                flush(i);
+            }
+        }
+    }
+};
+
+bool render_pyramid(const Image<RGBAF>& from, Mat3 rot,
+    const RemapParams& remap_params, size_t width, size_t height,
+    const PyramidParams& params, const std::string& base)
+{
+    if(params.tile_size < 2 || params.tile_size % 2 != 0)
+    {
+        fprintf(stderr, "[ERROR] Pyramid tile size must be even\n");
+        return false;
+    }
+    
+    PyramidWriter writer;
+    writer.params = params;
+    writer.base = base;
+    
+    // halve until a single pixel (Deep Zoom) or a single tile (XYZ)
+    size_t w = width, h = height;
+    
+    while(true)
+    {
+        PyramidLevel level;
+        level.width = w;
+        level.height = h;
+        level.number = 0;
+        level.band.resize(w, params.tile_size);
+        level.band_y = 0;
+        level.rows = 0;
+        writer.levels.push_back(level);
+        
+        if(params.layout == PYRAMID_DEEPZOOM && w == 1 && h == 1)
+            break;
+        if(params.layout == PYRAMID_XYZ && 
+           w <= params.tile_size && h <= params.tile_size)
+            break;
+        
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+    
+    for(size_t i = 0; i < writer.levels.size(); i++)
+    {
+        writer.levels[i].number = writer.levels.size() - 1 - i;
+    }
+    
+    if(!writer.make_dirs())
+        return false;
+    
+    printf("Pyramid:     %lu levels of %lux%lu tiles (%s)\n", 
+        writer.levels.size(), params.tile_size, params.tile_size,
+        params.layout == PYRAMID_DEEPZOOM ? "Deep Zoom" : "z/x/y");
+    
+    // render the full resolution level one row of tiles at a time; each
+    // row is cut up and encoded while the next one is rendered
+    if(!remap_streamed(writer, from, rot, remap_params, width, height,
+        params.tile_size))
+    {
+        fprintf(stderr, "[ERROR] Failed to write the pyramid tiles\n");
+        return false;
+    }
+    
+    if(params.layout == PYRAMID_DEEPZOOM)
+    {
+        FILE* fp = fopen((base + ".dzi").c_str(), "w");
+        
+        if(!fp)
+        {
+            perror("render_pyramid");
+            return false;
+        }
+        
+        fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\"\n"
+            "       TileSize=\"%lu\" Overlap=\"0\" Format=\"jpg\">\n"
+            "  <Size Width=\"%lu\" Height=\"%lu\"/>\n"
+            "</Image>\n", params.tile_size, width, height);
+        
+        fclose(fp);
+    }
+    
+    return true;
+}
@@ -1,27 +1,23 @@
 #include "custom_math.h"
 #include "image.h"
 #include "remap.h"
+#include "remap_kernel.h"
 
 #include <cmath>
+#include <thread>
 using namespace std;
 
 
-void remap_full3(Image<RGBAF>& onto, const Image<RGBAF>& from, Mat3 rot,
-    const double s)
+// gaussian weights for an XSAMPS x YSAMPS grid of subsamples, normalized
+// so that they sum to one
+static void build_filter_table(double* filter_table, 
+    const int XSAMPS, const int YSAMPS, const double s)
 {
-    LL2Vec3_Table lookup_table(onto.width, onto.height, 9);
-    
-    // these should be odd to ensure we hit the center of AA range exactly
-    const int XSAMPS = 9;
-    const int YSAMPS = 9;
-    
-    double filter_table[XSAMPS*YSAMPS];
-    
     for(int y = 0; y < YSAMPS; y++)
     for(int x = 0; x < XSAMPS; x++)
     {
-        double X = x - (double)XSAMPS/2.0;
-        double Y = y - (double)YSAMPS/2.0;
+        double X = x - (XSAMPS-1)/2.0;
+        double Y = y - (YSAMPS-1)/2.0;
         
         filter_table[XSAMPS*y+x] = exp(-(X*X + Y*Y)/(2*s));
     }
@@ -36,71 +32,596 @@ void remap_full3(Image<RGBAF>& onto, const Image<RGBAF>& from, Mat3 rot,
     {
         filter_table[i] /= sum;
     }
+}
 
-    #pragma omp parallel for
-    for(size_t y = 0; y < onto.height; y++)
-    for(size_t x = 0; x < onto.width; x++)
+const LL2Vec3_Table& RemapCache::table(int width, int height, 
+    int subpixels)
+{
+    for(size_t i = 0; i < tables.size(); i++)
     {
-        RGBAF out_pixel;
+        const LL2Vec3_Table& t = tables[i];
         
-        for(int sub_y = 0; sub_y < YSAMPS; sub_y++)
-        for(int sub_x = 0; sub_x < XSAMPS; sub_x++)
+        if(t.width == width && t.height == height && 
+           t.subpixels == subpixels)
         {
-            Vec3 v = lookup_table.lookup(x, sub_x, y, sub_y);
-            v = rot * v;
-            LatLong LL_src = vec3_to_latlong(v);
-            
-            double src_x = LL_src.long_ / (2*M_PI) * (from.width-1);
-            double src_y = 
-                (M_PI - (LL_src.lat+(M_PI/2)))/ M_PI * (from.height-1);
-            
-            if(src_x > from.width-1)
-                src_x = from.width - 1;
-            if(src_y > from.height-1)
-                src_y = from.height - 1;
-            if(src_x < 0)
-                src_x = 0;
-            if(src_y < 0)
-                src_y = 0;
+            return t;
+        }
+    }
+    
+    tables.push_back(LL2Vec3_Table(width, height, subpixels));
+    return tables.back();
+}
+
+bool parse_engine(RemapEngine& out, const std::string& name)
+{
+    if(name == "full3")
+        out = ENGINE_FULL3;
+    else if(name == "fast")
+        out = ENGINE_FAST;
+    else if(name == "area")
+        out = ENGINE_AREA;
+    else
+        return false;
+    
+    return true;
+}
+
+const char* engine_name(RemapEngine engine)
+{
+    switch(engine)
+    {
+        case ENGINE_FULL3:
+            return "full3";
+        case ENGINE_FAST:
+            return "fast";
+        case ENGINE_AREA:
+            return "area";
+    }
+    
+    return "unknown";
+}
+
+template<typename Dst, typename Src>
+static void remap_fast_source(Dst& onto, const Src& from, Mat3 rot,
+    const RemapParams& params)
+{
+    if(params.channels == 3)
+        fast_kernel<3>(onto, from, rot, params);
+    else
+        fast_kernel<4>(onto, from, rot, params);
+}
+
+template<typename Dst, typename Src>
+static void remap_full3_source(Dst& onto, const Src& from, 
+    Mat3 rot, const RemapParams& params)
+{
+    // samples should be odd to ensure we hit the center of AA range exactly
+    if(params.samples < 2)
+    {
+        remap_fast_source(onto, from, rot, params);
+        return;
+    }
+    
+    if(params.channels == 3)
+        full3_kernel<3>(onto, from, rot, params);
+    else
+        full3_kernel<4>(onto, from, rot, params);
+}
+
+bool lattice_permutation(Mat3 rot, size_t width, size_t height,
+    LatticePermutation& out)
+{
+    const double eps = 1e-9;
+    
+    if(width < 2 || height < 2)
+        return false;
+    
+    // the poles have to stay on the polar axis, so latitudes are kept
+    // or negated
+    if(fabs(rot[2]) > eps || fabs(rot[5]) > eps ||
+       fabs(rot[6]) > eps || fabs(rot[7]) > eps ||
+       fabs(fabs(rot[8]) - 1.0) > eps)
+    {
+        return false;
+    }
+    
+    // the xy block is then a rotation (longitude + t) or, with the
+    // latitudes negated, a reflection (t - longitude)
+    out.mirror = rot[8] < 0;
+    
+    double t = atan2(rot[3], rot[0]);
+    double period = width - 1;
+    double shift = t / (2*M_PI) * period;
+    double columns = floor(shift + 0.5);
+    
+    // the shift must land exactly on a column
+    if(fabs(shift - columns) > 1e-6)
+        return false;
+    
+    long k = (long)columns % (long)(width - 1);
+    out.shift = k < 0 ? k + (width - 1) : k;
+    
+    return true;
+}
+
+// copies instead of filtering when rot permutes the pixel centers of a
+// same size output; returns false if it does not
+template<typename Dst, typename Src>
+static bool remap_permutation(Dst& onto, const Src& from, Mat3 rot,
+    const RemapParams& params)
+{
+    LatticePermutation perm;
+    
+    if(onto.width != from.width || params.full_height(onto) != from.height ||
+       !lattice_permutation(rot, from.width, from.height, perm))
+    {
+        return false;
+    }
+    
+    permute_kernel(onto, from, perm, params);
+    return true;
+}
+
+template<typename Dst, typename Src>
+static void remap_source(Dst& onto, const Src& from, Mat3 rot,
+    const RemapParams& band_params)
+{
+    // a tile gate sees the rows of the whole output
+    RemapParams params = band_params;
+    params.schedule.gate_row_offset = params.row_offset;
+    
+    if(remap_permutation(onto, from, rot, params))
+        return;
+    
+    switch(params.engine)
+    {
+        case ENGINE_FULL3:
+            remap_full3_source(onto, from, rot, params);
+            break;
+        case ENGINE_FAST:
+            remap_fast_source(onto, from, rot, params);
+            break;
+        case ENGINE_AREA:
+        {
+            // a cached table keeps its storage from one source to the next
+            SummedAreaTable own;
+            SummedAreaTable& sat = params.cache ? params.cache->sat : own;
             
-            double scale = filter_table[sub_y*XSAMPS + sub_x];
-            out_pixel += scale * bilinear_get(from, src_x, src_y);
+            sat.build(from);
+            area_kernel(onto, sat, rot, params);
+            break;
         }
+    }
+}
+
+template<typename Src>
+static bool remap_streamed_source(RowWriter& writer, const Src& from, 
+    Mat3 rot, const RemapParams& params, size_t width, size_t height, 
+    size_t band_rows)
+{
+    RemapParams band_params = params;
+    band_params.output_height = params.output_height ? params.output_height
+                                                     : height;
+    
+    // band k is rendered into bands[k % 2] while band k-1 is encoded from
+    // the other one; the encoder is joined before its buffer is reused
+    Image<RGBAF> bands[2];
+    thread encoder;
+    bool ok = true;
+    
+    // the area engine's table depends only on the source, so it is built
+    // once instead of for every band (and not at all for permutations)
+    SummedAreaTable sat;
+    LatticePermutation perm;
+    
+    bool area = params.engine == ENGINE_AREA &&
+        !(width == from.width && band_params.output_height == from.height &&
+          lattice_permutation(rot, from.width, from.height, perm));
+    
+    if(area)
+        sat.build(from);
+    
+    for(size_t y = 0, k = 0; y < height; y += band_rows, k++)
+    {
+        Image<RGBAF>& band = bands[k % 2];
         
-        onto.put(x,y,out_pixel);
+        band.resize(width, y + band_rows < height ? band_rows : height - y);
+        band_params.row_offset = params.row_offset + y;
+        
+        if(area)
+            area_kernel(band, sat, rot, band_params);
+        else
+            remap_source(band, from, rot, band_params);
+        
+        if(encoder.joinable())
+            encoder.join();
+        
+        // a writer that failed won't get any better
+        if(!ok)
+            break;
+        
+        encoder = thread([&writer, &band, &ok]()
+        {
+            unpin_thread();
+            
+            if(!writer.write_rows(band))
+                ok = false;
+        });
     }
+    
+    if(encoder.joinable())
+        encoder.join();
+    
+    return ok;
+}
+
+void remap(Image<RGBAF>& onto, const Image<RGBAF>& from, Mat3 rot,
+    const RemapParams& params)
+{
+    remap_source(onto, from, rot, params);
+}
+
+void remap(Image<RGBAF>& onto, const TiledImage<RGBAF>& from, Mat3 rot,
+    const RemapParams& params)
+{
+    remap_source(onto, from, rot, params);
+}
+
+void remap(Image<RGBAF>& onto, const SourceWindow& from, Mat3 rot,
+    const RemapParams& params)
+{
+    remap_source(onto, from, rot, params);
+}
+
+size_t source_rows_needed(Mat3 rot, size_t output_width, 
+    size_t output_height, size_t source_height, size_t x0, size_t y0,
+    size_t x1, size_t y1)
+{
+    if(output_width < 2 || output_height < 2)
+        return source_height;
+    
+    // the tile's samples reach half a pixel past its outer pixel centers
+    double a = (x0 - 0.5) / (output_width - 1.0) * 2*M_PI;
+    double b = (x1 - 0.5) / (output_width - 1.0) * 2*M_PI;
+    double hi = M_PI/2 - (y0 - 0.5) / (output_height - 1.0) * M_PI;
+    double lo = M_PI/2 - (y1 - 0.5) / (output_height - 1.0) * M_PI;
+    
+    // samples past a pole come back down on the opposite meridian
+    if(hi > M_PI/2 || lo < -M_PI/2)
+        b = a + 2*M_PI;
+    
+    hi = hi < M_PI/2 ? hi : M_PI/2;
+    lo = lo > -M_PI/2 ? lo : -M_PI/2;
+    
+    // the lowest source row comes from the lowest source height z = r.d,
+    // with r the bottom row of rot. At latitude lat and longitude lon
+    // that is cos(lat) * rho * cos(lon - phi) + r[2] * sin(lat).
+    double rho = sqrt(rot[6]*rot[6] + rot[7]*rot[7]);
+    double phi = atan2(rot[7], rot[6]);
+    
+    // smallest cos(lon - phi) over a..b, the same for every latitude
+    double c = min(cos(a - phi), cos(b - phi));
+    double away = a + fmod(fmod(phi + M_PI - a, 2*M_PI) + 2*M_PI, 2*M_PI);
+    
+    if(b - a >= 2*M_PI || away <= b)
+        c = -1.0;
+    
+    // then A cos(lat) + B sin(lat) over lo..hi: the ends, or where the
+    // derivative is zero
+    double A = rho * c;
+    double B = rot[8];
+    double z = min(A*cos(lo) + B*sin(lo), A*cos(hi) + B*sin(hi));
+    
+    double turn = atan2(B, A);
+    turn = turn > M_PI/2 ? turn - M_PI : (turn < -M_PI/2 ? turn + M_PI : turn);
+    
+    if(turn > lo && turn < hi)
+        z = min(z, A*cos(turn) + B*sin(turn));
+    
+    z = z > -1.0 ? (z < 1.0 ? z : 1.0) : -1.0;
+    
+    // plus the row below for the bilinear taps and one for rounding
+    double row = acos(z) / M_PI * (source_height - 1.0);
+    size_t rows = (size_t)ceil(row) + 2;
+    
+    return rows < source_height ? rows : source_height;
+}
+
+void source_row_range(Mat3 rot, size_t output_height, size_t first_row,
+    size_t end_row, double& top, double& bottom)
+{
+    // the output rows cover latitudes lo..hi (half a row beyond the
+    // outer pixel centers, where the sample grids reach)
+    double rows = output_height > 1 ? output_height - 1.0 : 1.0;
+    double hi = M_PI/2 - (first_row - 0.5) / rows * M_PI;
+    double lo = M_PI/2 - (end_row - 0.5) / rows * M_PI;
+    
+    hi = hi < M_PI/2 ? hi : M_PI/2;
+    lo = lo > -M_PI/2 ? lo : -M_PI/2;
+    
+    // a direction at latitude lat lands at source height z = r.d, where r
+    // is the bottom row of rot, at angle beta above the equator. Over all
+    // longitudes z spans -cos(lat+beta) .. cos(lat-beta), so the source
+    // latitude reaches pi/2 - |lat-beta| and |lat+beta| - pi/2.
+    double z = rot[8] < 1.0 ? (rot[8] > -1.0 ? rot[8] : -1.0) : 1.0;
+    double beta = asin(z);
+    
+    // |lat-beta| and |lat+beta| at their smallest over lo..hi
+    double near_up = beta < lo ? lo - beta : (beta > hi ? beta - hi : 0.0);
+    double near_down = -beta < lo ? lo + beta 
+                                  : (-beta > hi ? -beta - hi : 0.0);
+    
+    double lat_max = M_PI/2 - near_up;
+    double lat_min = near_down - M_PI/2;
+    
+    top = (M_PI/2 - lat_max) / M_PI;
+    bottom = (M_PI/2 - lat_min) / M_PI;
+}
+
+void remap(const PixelBuffer& onto, const PixelBuffer& from, Mat3 rot,
+    const RemapParams& params)
+{
+    PixelBuffer dst = onto;
+    RemapParams buffer_params = params;
+    
+    if(from.channels == 3)
+        buffer_params.channels = 3;
+    
+    switch(from.format)
+    {
+        case PIXEL_U8:
+            remap_source(dst, SourceBuffer<PIXEL_U8>(from), rot, 
+                buffer_params);
+            break;
+        case PIXEL_U16:
+            remap_source(dst, SourceBuffer<PIXEL_U16>(from), rot, 
+                buffer_params);
+            break;
+        case PIXEL_F16:
+            remap_source(dst, SourceBuffer<PIXEL_F16>(from), rot, 
+                buffer_params);
+            break;
+        case PIXEL_F32:
+            remap_source(dst, SourceBuffer<PIXEL_F32>(from), rot, 
+                buffer_params);
+            break;
+    }
+}
+
+void remap_full3(Image<RGBAF>& onto, const Image<RGBAF>& from, Mat3 rot,
+    const double s)
+{
+    RemapParams params;
+    params.sigma = s;
+    remap_full3(onto, from, rot, params);
+}
+
+void remap_full3(Image<RGBAF>& onto, const Image<RGBAF>& from, Mat3 rot,
+    const RemapParams& params)
+{
+    remap_full3_source(onto, from, rot, params);
+}
+
+void remap_full3(Image<RGBAF>& onto, const TiledImage<RGBAF>& from,
+    Mat3 rot, const RemapParams& params)
+{
+    remap_full3_source(onto, from, rot, params);
 }
 
 void remap_fast(Image<RGBAF>& onto, const Image<RGBAF>& from, Mat3 rot)
 {
-    LL2Vec3_Table lookup_table(onto.width, onto.height, 3);
+    remap_fast(onto, from, rot, RemapParams());
+}
+
+void remap_fast(Image<RGBAF>& onto, const Image<RGBAF>& from, Mat3 rot,
+    const RemapParams& params)
+{
+    remap_fast_source(onto, from, rot, params);
+}
+
+void remap_fast(Image<RGBAF>& onto, const TiledImage<RGBAF>& from,
+    Mat3 rot, const RemapParams& params)
+{
+    remap_fast_source(onto, from, rot, params);
+}
+
+bool remap_streamed(RowWriter& writer, const Image<RGBAF>& from, Mat3 rot,
+    const RemapParams& params, size_t width, size_t height, size_t band_rows)
+{
+    return remap_streamed_source(writer, from, rot, params, width, height,
+        band_rows);
+}
+
+bool remap_streamed(RowWriter& writer, const TiledImage<RGBAF>& from, 
+    Mat3 rot, const RemapParams& params, size_t width, size_t height, 
+    size_t band_rows)
+{
+    return remap_streamed_source(writer, from, rot, params, width, height,
+        band_rows);
+}
+
+bool remap_streamed(RowWriter& writer, const SourceWindow& from, 
+    Mat3 rot, const RemapParams& params, size_t width, size_t height, 
+    size_t band_rows)
+{
+    return remap_streamed_source(writer, from, rot, params, width, height,
+        band_rows);
+}
+
+bool remap_streamed(RowWriter& writer, const PixelBuffer& from, 
+    Mat3 rot, const RemapParams& params, size_t width, size_t height, 
+    size_t band_rows)
+{
+    RemapParams buffer_params = params;
     
-    #pragma omp parallel for
-    for(size_t y = 0; y < onto.height; y++)
-    for(size_t x = 0; x < onto.width; x++)
+    if(from.channels == 3)
+        buffer_params.channels = 3;
+    
+    switch(from.format)
     {
-        RGBAF out_pixel;
+        case PIXEL_U8:
+            return remap_streamed_source(writer, SourceBuffer<PIXEL_U8>(from),
+                rot, buffer_params, width, height, band_rows);
+        case PIXEL_U16:
+            return remap_streamed_source(writer, SourceBuffer<PIXEL_U16>(from),
+                rot, buffer_params, width, height, band_rows);
+        case PIXEL_F16:
+            return remap_streamed_source(writer, SourceBuffer<PIXEL_F16>(from),
+                rot, buffer_params, width, height, band_rows);
+        case PIXEL_F32:
+            return remap_streamed_source(writer, SourceBuffer<PIXEL_F32>(from),
+                rot, buffer_params, width, height, band_rows);
+    }
+    
+    return false;
+}
+
+void remap_multi(std::vector<Image<RGBAF>*>& onto, const Image<RGBAF>& from,
+    const std::vector<Mat3>& rots, const RemapParams& params)
+{
+    // outputs whose rotation only permutes pixel centers are copied on
+    // their own; the others share the filtered pass below
+    vector<Image<RGBAF>*> targets;
+    vector<Mat3> target_rots;
+    
+    for(size_t k = 0; k < onto.size(); k++)
+    {
+        if(!remap_permutation(*onto[k], from, rots[k], params))
+        {
+            targets.push_back(onto[k]);
+            target_rots.push_back(rots[k]);
+        }
+    }
     
-        Vec3 v = lookup_table.lookup(x, 1, y, 1);
-        v = rot * v;
-        LatLong LL_src = vec3_to_latlong(v);
+    if(targets.empty())
+        return;
+    
+    if(params.engine == ENGINE_AREA)
+    {
+        SummedAreaTable sat;
+        sat.build(from);
         
-        double src_x = LL_src.long_ / (2*M_PI) * (from.width-1);
-        double src_y = 
-            (M_PI - (LL_src.lat+(M_PI/2)))/ M_PI * (from.height-1);
+        for(size_t k = 0; k < targets.size(); k++)
+            area_kernel(*targets[k], sat, target_rots[k], params);
         
-        if(src_x > from.width-1)
-            src_x = from.width - 1;
-        if(src_y > from.height-1)
-            src_y = from.height - 1;
-        if(src_x < 0)
-            src_x = 0;
-        if(src_y < 0)
-            src_y = 0;
+        return;
+    }
+    
+    // the fast engine is the center tap of a 3x3 grid
+    int samples = params.samples;
+    
+    if(params.engine == ENGINE_FAST || samples < 2)
+        samples = 1;
+    
+    const int grid = samples == 1 ? 3 : samples;
+    
+    LL2Vec3_Table lookup_table(targets[0]->width, 
+        params.full_height(*targets[0]), grid);
+    
+    vector<int> tap_x(grid*grid, 1);
+    vector<int> tap_y(grid*grid, 1);
+    vector<double> tap_weight(grid*grid, 1.0);
+    int tap_count = 1;
+    
+    if(samples > 1)
+    {
+        vector<double> filter_table(grid*grid);
+        build_filter_table(&filter_table[0], grid, grid, params.sigma);
         
-        out_pixel = bilinear_get(from, src_x, src_y);
+        tap_count = prune_taps(&filter_table[0], grid, 
+            params.prune_epsilon, &tap_x[0], &tap_y[0], &tap_weight[0]);
+    }
     
-        onto.put(x,y,out_pixel);
+    const size_t count = target_rots.size();
+    
+    parallel_tiles(targets[0]->width, targets[0]->height, params.schedule,
+        [&](size_t x0, size_t y0, size_t x1, size_t y1)
+    {
+        vector<double> acc(4*count);
+        
+        if(params.channels == 3)
+            multi_tile<3>(&targets[0], from, &target_rots[0], count, 
+                lookup_table, tap_count, &tap_x[0], &tap_y[0], &tap_weight[0], 
+                params.row_offset, &acc[0], x0, y0, x1, y1);
+        else
+            multi_tile<4>(&targets[0], from, &target_rots[0], count, 
+                lookup_table, tap_count, &tap_x[0], &tap_y[0], &tap_weight[0], 
+                params.row_offset, &acc[0], x0, y0, x1, y1);
+    });
+}
+
+void remap_rectilinear(std::vector<Viewport>& views, const Image<RGBAF>& from,
+    Mat3 rot, const double s)
+{
+    // same supersampling grid and filter as remap_full3
+    const int XSAMPS = 9;
+    const int YSAMPS = 9;
+    
+    double filter_table[XSAMPS*YSAMPS];
+    build_filter_table(filter_table, XSAMPS, YSAMPS, s);
+    
+    int tap_x[XSAMPS*YSAMPS];
+    int tap_y[XSAMPS*YSAMPS];
+    double tap_weight[XSAMPS*YSAMPS];
+    
+    int tap_count = prune_taps(filter_table, XSAMPS, 
+        RemapParams().prune_epsilon, tap_x, tap_y, tap_weight);
+    
+    // per-view camera setup; every output row of every view becomes one
+    // job so that all views are rendered in a single parallel pass and
+    // small views don't leave threads idle
+    vector<Mat3> cam_rot(views.size());
+    vector<double> focal(views.size());
+    vector<size_t> first_row(views.size()+1, 0);
+    
+    for(size_t i = 0; i < views.size(); i++)
+    {
+        const Viewport& view = views[i];
+        
+        cam_rot[i] = rot * view.rot;
+        focal[i] = (view.onto->width / 2.0) / tan(view.hfov / 2.0);
+        first_row[i+1] = first_row[i] + view.onto->height;
+    }
+    
+    const long total_rows = first_row[views.size()];
+    
+    #pragma omp parallel for schedule(dynamic)
+    for(long job = 0; job < total_rows; job++)
+    {
+        size_t i = 0;
+        while(first_row[i+1] <= (size_t)job)
+            i++;
+        
+        Image<RGBAF>& onto = *views[i].onto;
+        const Mat3& m = cam_rot[i];
+        const double f = focal[i];
+        
+        size_t y = job - first_row[i];
+        double cx = (onto.width  - 1) / 2.0;
+        double cy = (onto.height - 1) / 2.0;
+        
+        for(size_t x = 0; x < onto.width; x++)
+        {
+            RGBAF out_pixel;
+            
+            for(int i = 0; i < tap_count; i++)
+            {
+                // camera looks down +X with +Y to the right and +Z up
+                double u = x + 1.0/(XSAMPS-1) * tap_x[i] - 0.5 - cx;
+                double w = y + 1.0/(YSAMPS-1) * tap_y[i] - 0.5 - cy;
+                
+                double len = sqrt(f*f + u*u + w*w);
+                Vec3 v(f/len, u/len, -w/len);
+                v = m * v;
+                
+                double src_x, src_y;
+                vec3_to_src(v, from.width, from.height, src_x, src_y);
+                
+                out_pixel += tap_weight[i] * bilinear_get(from, src_x, src_y);
+            }
+            
+            onto.put(x,y,out_pixel);
+        }
     }
 }
 
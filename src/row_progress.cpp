@@ -0,0 +1,109 @@
+#include "row_progress.h"
+#include "remap.h"
+
+using namespace std;
+
+void RowProgress::image_sized(const ImageLoadResult& sized_info)
+{
+    if(coverage && sized_info.spp != 3)
+        coverage->resize(*image);
+    else
+        coverage = 0;
+    
+    lock_guard<mutex> hold(lock);
+    
+    info = sized_info;
+    sized = true;
+    changed.notify_all();
+}
+
+void RowProgress::rows_ready(size_t rows)
+{
+    // rows are reported by one thread at a time
+    if(coverage)
+        coverage->build_rows(*image, rows);
+    
+    lock_guard<mutex> hold(lock);
+    
+    if(rows > ready)
+        ready = rows;
+    
+    changed.notify_all();
+}
+
+void RowProgress::finish(bool ok)
+{
+    lock_guard<mutex> hold(lock);
+    
+    info.ok = ok;
+    done = true;
+    changed.notify_all();
+}
+
+bool RowProgress::wait_sized(ImageLoadResult& out)
+{
+    unique_lock<mutex> hold(lock);
+    
+    while(!sized && !done)
+        changed.wait(hold);
+    
+    // a load can fail after sizing the image, but then the rows that
+    // are waited for never come
+    out = info;
+    return sized && (!done || info.ok);
+}
+
+bool RowProgress::wait_rows(size_t rows)
+{
+    unique_lock<mutex> hold(lock);
+    
+    while(ready < rows && !done)
+        changed.wait(hold);
+    
+    return ready >= rows;
+}
+
+BackgroundLoad::~BackgroundLoad()
+{
+    if(loader.joinable())
+        loader.join();
+}
+
+void BackgroundLoad::start(Image<RGBAF>& into, const std::string& path,
+    ImageLoadParams params, CoverageMask* coverage)
+{
+    params.listener = &progress;
+    progress.coverage = coverage;
+    progress.image = &into;
+    
+    // --threads only set the OpenMP team size of the main thread
+    int threads = thread_count();
+    
+    loader = thread([this, &into, path, params, threads]()
+    {
+        unpin_thread();
+        set_thread_count(threads);
+        
+        result = load(into, path, params);
+        progress.finish(result.ok);
+    });
+}
+
+bool BackgroundLoad::finish()
+{
+    if(loader.joinable())
+        loader.join();
+    
+    return result.ok;
+}
+
+size_t SourceRowGate::need(size_t x0, size_t y0, size_t x1, size_t y1) const
+{
+    return source_rows_needed(rot, output_width, output_height,
+        source_height, x0, y0, x1, y1);
+}
+
+bool SourceRowGate::wait(size_t need) const
+{
+    return progress->wait_rows(need);
+}
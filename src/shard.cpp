@@ -0,0 +1,206 @@
+#include "shard.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+#include "tiffio.h"
+
+static const char* SHARD_FORMAT = "panorotate shard: first row %lu of %lu";
+
+bool parse_band(size_t& first_row, size_t& end_row, const std::string& text)
+{
+    unsigned long first, end;
+    char tail;
+    
+    if(sscanf(text.c_str(), "%lu:%lu%c", &first, &end, &tail) != 2 ||
+       end <= first)
+    {
+        return false;
+    }
+    
+    first_row = first;
+    end_row = end;
+    return true;
+}
+
+std::string shard_description(size_t first_row, size_t full_height)
+{
+    char text[128];
+    snprintf(text, sizeof(text), SHARD_FORMAT,
+        (unsigned long)first_row, (unsigned long)full_height);
+    
+    return text;
+}
+
+struct ShardInfo
+{
+    string path;
+    uint32 width;
+    uint32 rows;
+    uint16 bps;
+    uint16 spp;
+    uint16 format;
+    unsigned long first_row;
+    unsigned long full_height;
+    
+    bool operator<(const ShardInfo& other) const
+    {
+        return first_row < other.first_row;
+    }
+};
+
+static bool read_shard_info(ShardInfo& info, const string& path)
+{
+    TIFF* tif = TIFFOpen(path.c_str(), "r");
+    
+    if(!tif)
+    {
+        fprintf(stderr, "[ERROR] Failed to open shard: %s\n", path.c_str());
+        return false;
+    }
+    
+    info.path = path;
+    info.width = info.rows = 0;
+    info.bps = info.spp = 0;
+    info.format = SAMPLEFORMAT_UINT;
+    
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &info.width);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &info.rows);
+    TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &info.bps);
+    TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &info.spp);
+    TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &info.format);
+    
+    char* description = 0;
+    TIFFGetField(tif, TIFFTAG_IMAGEDESCRIPTION, &description);
+    
+    bool ok = description &&
+        sscanf(description, SHARD_FORMAT,
+            &info.first_row, &info.full_height) == 2;
+    
+    TIFFClose(tif);
+    
+    if(!ok)
+    {
+        fprintf(stderr, "[ERROR] Not a panorotate shard: %s\n",
+            path.c_str());
+    }
+    
+    return ok;
+}
+
+bool merge_shards(const std::vector<std::string>& shards,
+    const std::string& path)
+{
+    if(shards.empty())
+    {
+        fprintf(stderr, "[ERROR] No shards to merge\n");
+        return false;
+    }
+    
+    vector<ShardInfo> infos(shards.size());
+    
+    for(size_t i = 0; i < shards.size(); i++)
+    {
+        if(!read_shard_info(infos[i], shards[i]))
+            return false;
+    }
+    
+    sort(infos.begin(), infos.end());
+    
+    // the shards must tile the output rows with no gap or overlap
+    const ShardInfo& first = infos[0];
+    unsigned long next_row = 0;
+    
+    for(size_t i = 0; i < infos.size(); i++)
+    {
+        const ShardInfo& info = infos[i];
+        
+        if(info.width != first.width || info.bps != first.bps ||
+           info.spp != first.spp || info.format != first.format ||
+           info.full_height != first.full_height)
+        {
+            fprintf(stderr, "[ERROR] Shard %s does not match %s\n",
+                info.path.c_str(), first.path.c_str());
+            return false;
+        }
+        
+        if(info.first_row != next_row)
+        {
+            fprintf(stderr, "[ERROR] Shards %s rows %lu to %lu\n",
+                info.first_row > next_row ? "are missing" : "overlap at",
+                min(info.first_row, next_row),
+                max(info.first_row, next_row) - 1);
+            return false;
+        }
+        
+        next_row += info.rows;
+    }
+    
+    if(next_row != first.full_height)
+    {
+        fprintf(stderr, "[ERROR] Shards are missing rows %lu to %lu\n",
+            next_row, first.full_height - 1);
+        return false;
+    }
+    
+    TIFF* out = TIFFOpen(path.c_str(), "w");
+    
+    if(!out)
+    {
+        perror("merge_shards");
+        return false;
+    }
+    
+    TIFFSetField(out, TIFFTAG_IMAGEWIDTH, first.width);
+    TIFFSetField(out, TIFFTAG_IMAGELENGTH, (uint32)first.full_height);
+    TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, first.spp);
+    TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, first.bps);
+    TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, first.format);
+    TIFFSetField(out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+    TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(out,0));
+    
+    if(first.spp == 4)
+    {
+        uint16 extra_list[1] = {EXTRASAMPLE_ASSOCALPHA};
+        TIFFSetField(out, TIFFTAG_EXTRASAMPLES, 1, &extra_list);
+    }
+    
+    // the encoded samples are copied a row at a time, unchanged
+    vector<unsigned char> row(TIFFScanlineSize(out));
+    uint32 out_row = 0;
+    bool ok = true;
+    
+    for(size_t i = 0; i < infos.size() && ok; i++)
+    {
+        TIFF* in = TIFFOpen(infos[i].path.c_str(), "r");
+        
+        if(!in)
+        {
+            fprintf(stderr, "[ERROR] Failed to open shard: %s\n",
+                infos[i].path.c_str());
+            ok = false;
+            break;
+        }
+        
+        for(uint32 y = 0; y < infos[i].rows && ok; y++)
+        {
+            if(TIFFReadScanline(in, &row[0], y, 0) < 0 ||
+               TIFFWriteScanline(out, &row[0], out_row++, 0) < 0)
+            {
+                fprintf(stderr, "[ERROR] Failed to copy row %u of %s\n",
+                    y, infos[i].path.c_str());
+                ok = false;
+            }
+        }
+        
+        TIFFClose(in);
+    }
+    
+    TIFFClose(out);
+    return ok;
+}
@@ -1,17 +1,24 @@
 #include <cstdio>
 #include <cmath>
+#include <omp.h>
+#include <unistd.h>
 using namespace std;
 
 #include "custom_math.h"
 #include "image.h"
 #include "remap.h"
+#include "parallel.h"
 #include "test.h"
 
 // rotate 90 degrees, rotate back, calculate and print stats
-void double_rotate_test(const Image<RGBAF>& src, Mat3 rot,bool preview_mode)
+ImageMetrics double_rotate_test(const Image<RGBAF>& src, Mat3 rot,
+    bool preview_mode, const RemapParams& params, Image<RGBAF>* heatmap)
 {
     Image<RGBAF> dst, dst2;
     
+    RemapParams test_params = params;
+    test_params.sigma = 0.001;
+    
     Mat3 inv = transpose(rot);
     
     dst.resize(src.width, src.height);
@@ -22,11 +29,11 @@ void double_rotate_test(const Image<RGBAF>& src, Mat3 rot,bool preview_mode)
     
     if(preview_mode)
     {
-        remap_fast(dst, src, rot);
+        remap_fast(dst, src, rot, test_params);
     }
     else
     {
-        remap_full3(dst, src, rot, 0.001);
+        remap(dst, src, rot, test_params);
     }
     
     printf("Rotating back...\n");
@@ -34,116 +41,145 @@ void double_rotate_test(const Image<RGBAF>& src, Mat3 rot,bool preview_mode)
     
     if(preview_mode)
     {
-        remap_fast(dst2, dst, inv);
+        remap_fast(dst2, dst, inv, test_params);
     }
     else
     {
-        remap_full3(dst2, dst, inv,  0.001);
+        remap(dst2, dst, inv, test_params);
     }
 
+    printf("Computing stats...\n");
+    printf("\n");
     
-    printf("Converting to 8-bit...\n");
-    Image<RGB8> out_src, out_dst;
+    ImageMetrics metrics = compare_images(src, dst2, heatmap);
+    print_metrics(metrics);
     
-    convert_image(out_src, src);
-    convert_image(out_dst, dst2);
+    return metrics;
+}
+
+void scaling_test(const Image<RGBAF>& src, Mat3 rot, bool preview_mode,
+    const RemapParams& params)
+{
+    Image<RGBAF> dst(src.width, src.height);
     
-    printf("Computing stats...\n");
-    printf("\n");
+    TileSchedule schedules[2];
+    schedules[0].kind = TileSchedule::STATIC_ROWS;
+    schedules[1] = params.schedule;
+    schedules[1].kind = TileSchedule::DYNAMIC_TILES;
+    
+    int saved_threads = thread_count();
+    double baseline[2] = {0, 0};
+    
+    printf("Scaling test (%s, %lu x %lu, %d cpus available)\n\n",
+        preview_mode ? "remap_fast" : "remap_full3",
+        src.width, src.height, omp_get_num_procs());
+    printf("threads    static rows          dynamic tiles %lux%lu\n",
+        schedules[1].tile_width, schedules[1].tile_height);
+    printf("           seconds  speedup     seconds  speedup\n");
+    
+    for(int threads = 1; threads <= 64; threads *= 2)
+    {
+        set_thread_count(threads);
+        printf("%-7d", threads);
+        
+        for(int i = 0; i < 2; i++)
+        {
+            RemapParams run_params = params;
+            run_params.schedule = schedules[i];
+            
+            double start = omp_get_wtime();
+            
+            if(preview_mode)
+                remap_fast(dst, src, rot, run_params);
+            else
+                remap_full3(dst, src, rot, run_params);
+            
+            double elapsed = omp_get_wtime() - start;
+            
+            if(threads == 1)
+                baseline[i] = elapsed;
+            
+            printf("    %8.3f  %6.2fx", elapsed, baseline[i] / elapsed);
+        }
+        
+        printf("%s\n", threads > omp_get_num_procs() ? "  (oversubscribed)" 
+                                                      : "");
+    }
+    
+    set_thread_count(saved_threads);
+}
 
-    RGBAF sad(0,0,0,0);
-    RGBAF ssd(0,0,0,0);
+void layout_test(const Image<RGBAF>& src, Mat3 rot, bool preview_mode,
+    const RemapParams& params)
+{
+    const size_t widths[3] = {8192, 16384, 32768};
+    const size_t band_height = 256;
+    
+    double memory = (double)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
     
-    RGBAF sad8(0,0,0,0);
-    RGBAF ssd8(0,0,0,0);
+    RemapParams run_params = params;
     
-    for(size_t y = 0; y < src.height; y++)
-    for(size_t x = 0; x < src.width; x++)
+    // the engine kernels are called directly: remap() would copy instead
+    // of sampling for rotations that permute the pixel grid
+    printf("Source layout test (%s, %lu output rows from the equator)\n\n",
+        preview_mode ? "remap_fast" : "remap_full3", band_height);
+    printf("width      rows      build tiles  tiles     speedup\n");
+    
+    for(int i = 0; i < 3; i++)
     {
-        RGBAF a = src.get(x,y);
-        RGBAF b = dst2.get(x,y);
+        const size_t width = widths[i];
+        const size_t height = width / 2;
+        
+        // the row major and tiled copies must both fit in memory
+        double needed = 2.0 * width * height * sizeof(RGBAF);
         
+        if(needed > 0.8 * memory)
+        {
+            printf("%-7lu    skipped (needs %.1f GiB)\n", width, 
+                needed / (1 << 30));
+            continue;
+        }
         
-        RGB8 a8 = out_src.get(x,y);
-        RGB8 b8 = out_dst.get(x,y);
+        // the input scaled up to the test size
+        Image<RGBAF> big(width, height);
         
-        double R = a.r - b.r;
-        double G = a.g - b.g;
-        double B = a.b - b.b;
+        #pragma omp parallel for
+        for(size_t y = 0; y < height; y++)
+        for(size_t x = 0; x < width; x++)
+        {
+            big.values[width*y + x] = bilinear_get(src,
+                (double)x / (width-1) * (src.width-1),
+                (double)y / (height-1) * (src.height-1));
+        }
         
-        double R8 = a8.r - b8.r;
-        double G8 = a8.g - b8.g;
-        double B8 = a8.b - b8.b;
+        Image<RGBAF> band(width, band_height);
+        run_params.output_height = height;
+        run_params.row_offset = (height - band_height) / 2;
         
-        sad.r += fabs(R);
-        sad.g += fabs(G);
-        sad.b += fabs(B);
+        double start = omp_get_wtime();
         
-        sad8.r += fabs(R8);
-        sad8.g += fabs(G8);
-        sad8.b += fabs(B8);
-                
-        ssd.r += R*R;
-        ssd.g += G*G;
-        ssd.b += B*B;
+        if(preview_mode)
+            remap_fast(band, big, rot, run_params);
+        else
+            remap_full3(band, big, rot, run_params);
         
-        ssd8.r += R8*R8;
-        ssd8.g += G8*G8;
-        ssd8.b += B8*B8;
+        double rows_time = omp_get_wtime() - start;
+        
+        start = omp_get_wtime();
+        TiledImage<RGBAF> tiled;
+        tiled.build(big);
+        double build_time = omp_get_wtime() - start;
+        
+        start = omp_get_wtime();
+        
+        if(preview_mode)
+            remap_fast(band, tiled, rot, run_params);
+        else
+            remap_full3(band, tiled, rot, run_params);
+        
+        double tiled_time = omp_get_wtime() - start;
+        
+        printf("%-7lu  %8.3f  %8.3f     %8.3f  %6.2fx\n", width, 
+            rows_time, build_time, tiled_time, rows_time / tiled_time);
     }
-    
-    RGBAF mad = sad;
-    mad.r /= src.width; mad.r /= src.height;
-    mad.g /= src.width; mad.g /= src.height;
-    mad.b /= src.width; mad.b /= src.height;
-    
-    RGBAF mad8 = sad8;
-    mad8.r /= src.width; mad8.r /= src.height;
-    mad8.g /= src.width; mad8.g /= src.height;
-    mad8.b /= src.width; mad8.b /= src.height;
-    
-    
-    printf("Sum of absolute differences (float):\n"
-           "Red:\t%f\n"
-           "Green:\t%f\n"
-           "Blue:\t%f\n",
-           sad.r, sad.g, sad.b);
-    printf("\n");
-    
-    printf("Mean absolute differences (float):\n"
-           "Red:\t%f\n"
-           "Green:\t%f\n"
-           "Blue:\t%f\n",
-           mad.r, mad.g, mad.b);
-    printf("\n");
-    
-    printf("Sum of squared differences (float):\n"
-           "Red:\t%f\n"
-           "Green:\t%f\n"
-           "Blue:\t%f\n",
-           ssd.r, ssd.g, ssd.b);
-    
-    printf("\n");
-    printf("\n");    
-    
-    printf("Sum of absolute differences (RGB8):\n"
-           "Red:\t%f\n"
-           "Green:\t%f\n"
-           "Blue:\t%f\n",
-           sad8.r, sad8.g, sad8.b);
-    printf("\n");
-    
-    printf("Mean absolute differences (RGB8):\n"
-           "Red:\t%f\n"
-           "Green:\t%f\n"
-           "Blue:\t%f\n",
-           mad8.r, mad8.g, mad8.b);
-    printf("\n");
-    
-    printf("Sum of squared differences (RGB8):\n"
-           "Red:\t%f\n"
-           "Green:\t%f\n"
-           "Blue:\t%f\n",
-           ssd8.r, ssd8.g, ssd8.b);
 }
-
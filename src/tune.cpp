@@ -0,0 +1,225 @@
+#include "tune.h"
+#include "metrics.h"
+#include "custom_math.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <omp.h>
+using namespace std;
+
+// the representative image is shrunk to this width so that a full search
+// only takes a few seconds
+static const size_t TUNE_WIDTH = 512;
+
+struct TuneCandidate
+{
+    RemapParams params;
+    double psnr;            // worst mean PSNR over all test rotations
+    double mpix_per_sec;    // output throughput of a single remap
+};
+
+static vector<Mat3> tune_rotations()
+{
+    vector<Mat3> rotations;
+    rotations.push_back(rotX(deg2rad(90)));
+    rotations.push_back(rotZ(deg2rad(30)) * rotY(deg2rad(20)) * 
+                        rotX(deg2rad(10)));
+    rotations.push_back(rotY(deg2rad(45)));
+    return rotations;
+}
+
+static vector<RemapParams> tune_grid(const RemapParams& base)
+{
+    const int samples[] = {3, 5, 7, 9};
+    const double sigmas[] = {0.001, 0.2, 0.4, 1.0};
+    
+    vector<RemapParams> grid;
+    
+    RemapParams fast = base;
+    fast.engine = ENGINE_FAST;
+    grid.push_back(fast);
+    
+    RemapParams area = base;
+    area.engine = ENGINE_AREA;
+    grid.push_back(area);
+    
+    for(size_t i = 0; i < sizeof(samples)/sizeof(samples[0]); i++)
+    for(size_t j = 0; j < sizeof(sigmas)/sizeof(sigmas[0]); j++)
+    {
+        RemapParams full = base;
+        full.engine = ENGINE_FULL3;
+        full.samples = samples[i];
+        full.sigma = sigmas[j];
+        grid.push_back(full);
+    }
+    
+    return grid;
+}
+
+bool autotune(RemapParams& out, const Image<RGBAF>& src, double min_psnr,
+    const RemapParams& base)
+{
+    Image<RGBAF> sample;
+    
+    if(src.width > TUNE_WIDTH)
+        downscale(sample, src, TUNE_WIDTH, 
+            src.height * TUNE_WIDTH / src.width);
+    else
+        sample = src;
+    
+    vector<Mat3> rotations = tune_rotations();
+    vector<RemapParams> grid = tune_grid(base);
+    
+    Image<RGBAF> there(sample.width, sample.height);
+    Image<RGBAF> back(sample.width, sample.height);
+    
+    printf("Autotuning on %lu x %lu sample, %lu rotations, "
+           "target %g dB\n\n", sample.width, sample.height,
+           rotations.size(), min_psnr);
+    printf("engine  samples  sigma      PSNR (dB)  Mpix/s\n");
+    
+    bool found = false;
+    TuneCandidate best;
+    
+    for(size_t i = 0; i < grid.size(); i++)
+    {
+        TuneCandidate c;
+        c.params = grid[i];
+        c.psnr = 1e9;
+        
+        double elapsed = 0.0;
+        
+        for(size_t r = 0; r < rotations.size(); r++)
+        {
+            double start = omp_get_wtime();
+            remap(there, sample, rotations[r], c.params);
+            elapsed += omp_get_wtime() - start;
+            
+            remap(back, there, transpose(rotations[r]), c.params);
+            
+            ImageMetrics m = compare_images(sample, back);
+            
+            if(m.mean_psnr < c.psnr)
+                c.psnr = m.mean_psnr;
+        }
+        
+        c.mpix_per_sec = 
+            sample.width * sample.height * rotations.size() / elapsed / 1e6;
+        
+        bool ok = c.psnr >= min_psnr;
+        
+        printf("%-6s  %7d  %-9g  %9.3f  %6.2f%s\n", 
+            engine_name(c.params.engine), 
+            c.params.engine == ENGINE_FULL3 ? c.params.samples : 1,
+            c.params.sigma, c.psnr, c.mpix_per_sec, ok ? "" : "  (rejected)");
+        
+        if(ok && (!found || c.mpix_per_sec > best.mpix_per_sec))
+        {
+            best = c;
+            found = true;
+        }
+    }
+    
+    printf("\n");
+    
+    if(!found)
+    {
+        fprintf(stderr, "[ERROR] No setting reached %g dB\n", min_psnr);
+        return false;
+    }
+    
+    printf("Selected: engine %s, samples %d, sigma %g (%.3f dB, "
+           "%.2f Mpix/s)\n", engine_name(best.params.engine),
+           best.params.engine == ENGINE_FULL3 ? best.params.samples : 1,
+           best.params.sigma, best.psnr, best.mpix_per_sec);
+    
+    out = best.params;
+    return true;
+}
+
+bool save_profile(const RemapParams& params, const std::string& path)
+{
+    FILE* fp = fopen(path.c_str(), "w");
+    
+    if(!fp)
+    {
+        perror("save_profile");
+        return false;
+    }
+    
+    fprintf(fp, "# panorotate remap profile (written by --autotune)\n");
+    fprintf(fp, "engine=%s\n", engine_name(params.engine));
+    fprintf(fp, "samples=%d\n", params.samples);
+    fprintf(fp, "sigma=%.17g\n", params.sigma);
+    fprintf(fp, "prune_epsilon=%.17g\n", params.prune_epsilon);
+    
+    fclose(fp);
+    return true;
+}
+
+bool load_profile(RemapParams& params, const std::string& path)
+{
+    FILE* fp = fopen(path.c_str(), "r");
+    
+    if(!fp)
+    {
+        fprintf(stderr, "[ERROR] Failed to open profile: %s\n", path.c_str());
+        return false;
+    }
+    
+    char line[256];
+    int line_number = 0;
+    bool ok = true;
+    
+    while(ok && fgets(line, sizeof(line), fp))
+    {
+        line_number++;
+        
+        char key[64];
+        char value[128];
+        
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+        
+        if(sscanf(line, " %63[^=]=%127s", key, value) != 2)
+        {
+            ok = false;
+        }
+        else if(strcmp(key, "engine") == 0)
+        {
+            ok = parse_engine(params.engine, value);
+        }
+        else if(strcmp(key, "samples") == 0)
+        {
+            // odd grids have a tap on the pixel center
+            params.samples = atoi(value);
+            ok = params.samples >= 1 && params.samples % 2 == 1;
+        }
+        else if(strcmp(key, "sigma") == 0)
+        {
+            params.sigma = atof(value);
+            ok = params.sigma > 0;
+        }
+        else if(strcmp(key, "prune_epsilon") == 0)
+        {
+            params.prune_epsilon = atof(value);
+            ok = params.prune_epsilon >= 0;
+        }
+        else
+        {
+            fprintf(stderr, "[WARNING] Unknown profile key '%s' in %s\n",
+                key, path.c_str());
+        }
+        
+        if(!ok)
+        {
+            fprintf(stderr, "[ERROR] Bad profile entry on line %d of %s\n",
+                line_number, path.c_str());
+        }
+    }
+    
+    fclose(fp);
+    return ok;
+}